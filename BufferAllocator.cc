@@ -0,0 +1,194 @@
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+#include <unordered_map>
+#include <atomic>
+#include <stdint.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include <assert.h>
+
+#include "BufferAllocator.h"
+#include "ThreadPool.h"
+
+using namespace std;
+
+#define HUGE_PAGE_SIZE ( 2ULL << 20 )
+#define TOUCH_BLOCK ( 8ULL << 20 )  // bytes faulted in by one task
+#define MAX_NUMA_NODE 1024
+
+typedef struct {
+  unsigned char* base;  // start of the mapping, the buffer may start later to be aligned
+  unsigned long long length;
+} Mapping;
+
+typedef struct {
+  unsigned char* start;
+  unsigned long long length;
+  unsigned long long pageSize;
+} TouchJob;
+
+static HugePageMode hugePage = HUGE_PAGE_NONE;
+static int numaNode = NUMA_NODE_NONE;
+static unsigned int numTouchThread = 1;
+static atomic< bool > hugeTlbFailed( false );  // the reserved pool was exhausted once, not tried again
+static atomic< bool > bindFailed( false );
+
+// Mapped buffers by their start, anything else came from new[]. Buffers are allocated and freed
+// by decoder threads too. numMapping lets the default policy free without taking the lock.
+static unordered_map< unsigned char*, Mapping > mappings;
+static atomic< unsigned long > numMapping( 0 );
+static pthread_mutex_t mappingLock = PTHREAD_MUTEX_INITIALIZER;
+
+// Faults pages in for all large allocations, skipped while another thread uses it
+static ThreadPool* touchPool = NULL;
+static pthread_mutex_t touchLock = PTHREAD_MUTEX_INITIALIZER;
+
+
+void setBufferPolicy( HugePageMode _hugePage, int _numaNode, unsigned int _numTouchThread )
+{
+  hugePage = _hugePage;
+  numaNode = _numaNode;
+  numTouchThread = _numTouchThread;
+  releaseBufferPolicy();
+  if( numTouchThread > 1 ) {
+    touchPool = new ThreadPool( numTouchThread );
+  }
+  if( numaNode == NUMA_NODE_LOCAL ) {
+    unsigned int cpu;
+    unsigned int node;
+    numaNode = syscall( SYS_getcpu, &cpu, &node, NULL ) == 0 ? ( int ) node : NUMA_NODE_NONE;
+  }
+  if( numaNode >= MAX_NUMA_NODE ) {
+    cout << "NUMA node " << numaNode << " is not supported, buffers are not bound\n";
+    numaNode = NUMA_NODE_NONE;
+  }
+}
+
+
+void releaseBufferPolicy()
+{
+  delete touchPool;
+  touchPool = NULL;
+}
+
+
+bool isDefaultBufferPolicy()
+{
+  return hugePage == HUGE_PAGE_NONE && numaNode == NUMA_NODE_NONE && numTouchThread <= 1;
+}
+
+
+const char* hugePageName( HugePageMode mode )
+{
+  switch( mode ) {
+  case HUGE_PAGE_NONE:
+    return "none";
+  case HUGE_PAGE_TRANSPARENT:
+    return "transparent";
+  case HUGE_PAGE_EXPLICIT:
+    return "explicit";
+  default:
+    return "unknown";
+  }
+}
+
+
+static void touchTask( unsigned long taskId, void* arg )
+{
+  // One write per page, so the kernel allocates it on this thread ( or on the bound node )
+  TouchJob* job = ( TouchJob* ) arg;
+  unsigned long long begin = taskId * TOUCH_BLOCK;
+  unsigned long long end = min( job->length, begin + TOUCH_BLOCK );
+  for( unsigned long long b = begin; b < end; b += job->pageSize ) {
+    job->start[ b ] = 0;
+  }
+}
+
+
+unsigned char* allocBuffer( unsigned long long size )
+{
+  if( size < BUFFER_MIN_SIZE || isDefaultBufferPolicy() ) {
+    return new unsigned char[ size ];
+  }
+
+  // Explicit huge pages first, then a mapping aligned to 2 MB so that transparent huge pages can back it
+  unsigned char* base = ( unsigned char* ) MAP_FAILED;
+  unsigned char* start;
+  unsigned long long length;
+  if( hugePage == HUGE_PAGE_EXPLICIT && !hugeTlbFailed ) {
+    length = ( size + HUGE_PAGE_SIZE - 1 ) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+    base = ( unsigned char* ) mmap( NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0 );
+    if( base == MAP_FAILED && !hugeTlbFailed.exchange( true ) ) {
+      cout << "No reserved huge page left for a buffer of " << size << " bytes, using transparent huge pages\n";
+    }
+    start = base;
+  }
+  if( base == MAP_FAILED ) {
+    unsigned long long align = hugePage != HUGE_PAGE_NONE ? HUGE_PAGE_SIZE : 0;
+    length = size + align;
+    base = ( unsigned char* ) mmap( NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+    if( base == MAP_FAILED ) {
+      cout << "Cannot map a buffer of " << size << " bytes\n";
+      assert( false );
+    }
+    start = align > 0 ? ( unsigned char* )( ( ( uintptr_t ) base + align - 1 ) / align * align ) : base;
+    if( hugePage != HUGE_PAGE_NONE ) {
+      madvise( start, length - ( start - base ), MADV_HUGEPAGE );
+    }
+  }
+
+  // Binding before any page is touched
+  if( numaNode >= 0 ) {
+    unsigned long mask[ MAX_NUMA_NODE / 64 ] = { 0 };
+    mask[ numaNode / 64 ] = 1UL << ( numaNode % 64 );
+    if( syscall( SYS_mbind, start, length - ( start - base ), MPOL_BIND, mask, sizeof( mask ) * 8, 0 ) != 0 && !bindFailed.exchange( true ) ) {
+      cout << "Cannot bind buffers to NUMA node " << numaNode << ": " << strerror( errno ) << endl;
+    }
+  }
+
+  if( touchPool != NULL && size >= 2 * TOUCH_BLOCK && pthread_mutex_trylock( &touchLock ) == 0 ) {
+    TouchJob job;
+    job.start = start;
+    job.length = size;
+    // Huge page mappings start on a 2 MB boundary, one write faults in a whole page
+    job.pageSize = hugePage != HUGE_PAGE_NONE ? HUGE_PAGE_SIZE : sysconf( _SC_PAGESIZE );
+    touchPool->run( ( job.length + TOUCH_BLOCK - 1 ) / TOUCH_BLOCK, touchTask, ( void* ) &job );
+    pthread_mutex_unlock( &touchLock );
+  }
+
+  Mapping mapping;
+  mapping.base = base;
+  mapping.length = length;
+  pthread_mutex_lock( &mappingLock );
+  mappings[ start ] = mapping;
+  numMapping++;
+  pthread_mutex_unlock( &mappingLock );
+  return start;
+}
+
+
+void freeBuffer( unsigned char* buff )
+{
+  if( buff == NULL ) {
+    return;
+  }
+  if( numMapping > 0 ) {
+    pthread_mutex_lock( &mappingLock );
+    auto mit = mappings.find( buff );
+    if( mit != mappings.end() ) {
+      Mapping mapping = mit->second;
+      mappings.erase( mit );
+      numMapping--;
+      pthread_mutex_unlock( &mappingLock );
+      munmap( mapping.base, mapping.length );
+      return;
+    }
+    pthread_mutex_unlock( &mappingLock );
+  }
+  delete [] buff;
+}
@@ -0,0 +1,41 @@
+#ifndef _MR_BUFFERALLOCATOR
+#define _MR_BUFFERALLOCATOR
+
+#include <cstddef>
+
+// Large buffers of the workers: inputs, packed partitions, packets, the sort buffer and the line lists.
+// By default they come from new[]. The policy can back them with 2 MB pages, bind them to a NUMA node
+// and fault their pages in on several threads. Buffers below BUFFER_MIN_SIZE always come from new[].
+
+enum HugePageMode {
+  HUGE_PAGE_NONE = 0,
+  HUGE_PAGE_TRANSPARENT,  // 2 MB aligned mappings with madvise( MADV_HUGEPAGE )
+  HUGE_PAGE_EXPLICIT  // MAP_HUGETLB from the reserved pool, transparent once the pool is exhausted
+};
+
+const int NUMA_NODE_NONE = -1;  // pages go where they are first touched
+const int NUMA_NODE_LOCAL = -2;  // node of the CPU running the process when the policy is set
+
+const unsigned long long BUFFER_MIN_SIZE = 1 << 20;
+
+// Same on every process of the job, set before the first large allocation
+void setBufferPolicy( HugePageMode hugePage, int numaNode, unsigned int numTouchThread );
+void releaseBufferPolicy();  // stops the threads that fault pages in, before MPI_Finalize
+bool isDefaultBufferPolicy();
+const char* hugePageName( HugePageMode mode );
+
+unsigned char* allocBuffer( unsigned long long size );
+void freeBuffer( unsigned char* buff );  // NULL is ignored
+
+// allocBuffer for STL containers, only large ones leave new[]
+template< class T > struct BufferAllocator {
+  typedef T value_type;
+  BufferAllocator() {}
+  template< class U > BufferAllocator( const BufferAllocator< U >& ) {}
+  T* allocate( size_t n ) { return ( T* ) allocBuffer( n * sizeof( T ) ); }
+  void deallocate( T* p, size_t ) { freeBuffer( ( unsigned char* ) p ); }
+};
+template< class T, class U > bool operator==( const BufferAllocator< T >&, const BufferAllocator< U >& ) { return true; }
+template< class T, class U > bool operator!=( const BufferAllocator< T >&, const BufferAllocator< U >& ) { return false; }
+
+#endif
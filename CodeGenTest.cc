@@ -1,146 +1,100 @@
 #include <iostream>
+#include <cstdlib>
 
 #include "CodeGeneration.h"
 
 using namespace std;
 
+// Checks the subset ids and the code plan of every node against a brute force count.
+// Usage: ./CodeGenTest [ largest K ] [ Eta ]
 
-int main( int argc, char* argv[] ) {
-  if ( argc < 4 ) {
-    cout << "Input format: N K R\n";
-    return 0;
-  }
+static int numError = 0;
 
-  CodeGeneration cg( atoi( argv[1] ), atoi( argv[2] ), atoi( argv[3] ) );
-  
-  vector< NodeSet > nR = cg.getNodeSubsetR();
-  cout << "Subset of nodes of size " << cg.getR() << ":\n";
-  for ( auto it = nR.begin(); it != nR.end(); ++it ) {
-    CodeGeneration::printNodeSet( *it );
-    cout << endl;
+static void check( bool ok, const char* what, int K, int R, int node )
+{
+  if( !ok ) {
+    cout << "K = " << K << ", R = " << R << ", node " << node << ": " << what << endl;
+    numError++;
   }
+}
 
-  int eta = cg.getEta();
-  cout << endl;  
-  cout << "Eta = " << eta << endl;
 
-  unordered_map< int, InputSet > m = cg.getM();
-  cout << endl;
-  cout << "Set M:\n";
-  for ( auto it = m.begin(); it != m.end(); ++it ) {
-    int nid = it->first;
-    InputSet inputs = it->second;
-    cout << "Node " << nid << " processes inputs: ";
-    for ( auto it2 = inputs.begin(); it2 != inputs.end(); ++it2 ) {
-      cout << *it2 << ' ';
-    }
-    cout << endl;
+static void testCode( int K, int R, int eta )
+{
+  unsigned long long numR = 1;
+  for( int i = 0; i < R; i++ ) {
+    numR = numR * ( K - i ) / ( i + 1 );
   }
+  unsigned long long numS = numR * ( K - R ) / ( R + 1 );
+  CodeGeneration cg( numR * eta, K, R );
+  check( cg.getNumSubsetR() == numR && cg.getNumSubsetS() == numS && cg.getEta() == eta, "wrong binomials", K, R, 0 );
 
-  unordered_map< int, ImMatrix > nim = cg.getNodeImMatrix();
-  cout << endl;
-  cout << "Intermediate values ( q, n ):\n";
-  for( int k = 1; k <= cg.getK(); k++ ) {
-    cout << "Node " << k << endl;
-    ImMatrix im = nim[ k ];
-    for( int i = 0; i < cg.getK(); i++ ) {
-      for( int j = 0; j < cg.getN(); j++ ) {
-	cout << int( im[ i ][ j ] ) << ' ';
-      }
-      cout << endl;
-    }
-    cout << endl;
+  // Rank / unrank round trip, masks in strictly ascending ( colexicographic ) order
+  NodeMask last = 0;
+  for( SubsetSId sid = 0; sid < numS; sid++ ) {
+    NodeMask mask = cg.getSubsetSMask( sid );
+    check( __builtin_popcountll( mask ) == R + 1, "subset of the wrong size", K, R, 0 );
+    check( mask < ( 1ULL << K ) && ( sid == 0 || mask > last ), "subsets out of order", K, R, 0 );
+    check( cg.getSubsetSId( mask ) == sid, "rank of unrank is not the id", K, R, 0 );
+    check( cg.getSubsetSId( cg.getSubsetSFromId( sid ) ) == sid, "node set round trip", K, R, 0 );
+    last = mask;
   }
-
-  vector< NodeSet > nS = cg.getNodeSubsetS();
-  cout << endl;
-  cout << "Subset of nodes of size " << cg.getR() + 1 << ":\n";
-  for ( auto it = nS.begin(); it != nS.end(); ++it ) {
-    CodeGeneration::printNodeSet( *it );
-    cout << endl;
+  for( unsigned long fid = 1; fid <= numR * eta; fid++ ) {
+    NodeMask mask = cg.getNodeMaskFromFileID( fid );
+    check( __builtin_popcountll( mask ) == R, "file on the wrong number of nodes", K, R, 0 );
+    check( cg.getFileIDFromNodeMask( mask ) == fid - ( fid - 1 ) % eta, "file id round trip", K, R, 0 );
   }
 
-  unordered_map< SubsetSId, unordered_map< int, VpairList > > sdstvlist = cg.getSubsetDestVpairList();
-  cout << endl;
-  cout << "Exclusive intermediate values:\n";
-  map< NodeSet, SubsetSId > sidmap = cg.getSubsetSIdMap();
-  for( auto sit = sidmap.begin(); sit != sidmap.end(); sit++ ) {
-    NodeSet s = sit->first;
-    SubsetSId id = sit->second;
-    cout << "Subset ";
-    CodeGeneration::printNodeSet( s );
-    cout << endl;
-    for( auto qit = s.begin(); qit != s.end(); ++qit ) {
-      int q = *qit;
-      cout << "  Node " << q << " needs: ";
-      VpairList l = sdstvlist[ id ][ q ];
-      for( unsigned int i = 0; i < l.size(); i++ ) {
-	cout << "( " << l[i].first << ", " << l[i].second << " ),  ";
-      }
-      NodeSet t = s;
-      t.erase( q );
-      cout << "// owned by nodes in ";
-      CodeGeneration::printNodeSet( t );
-      cout << endl;
-    }
-  }
+  // Plan of every node: ( R + 1 ) packets per subset containing it, R * Eta segments per packet
+  unsigned long long numContain = numS * ( R + 1 ) / K;
+  for( int node = 1; node <= K; node++ ) {
+    cg.generatePlan( node );
+    vector< PlanPacket >& packets = cg.getPlanPacket();
+    vector< PlanSegment >& segments = cg.getPlanSegment();
+    check( packets.size() == numContain * ( R + 1 ), "wrong number of packets", K, R, node );
+    check( segments.size() == packets.size() * cg.getNumSegment() && cg.getNumSegment() == R * eta, "wrong number of segments", K, R, node );
+    check( cg.getM( node ).size() == numR * R / K * eta, "wrong number of files", K, R, node );
 
-  unordered_map< SubsetSId, unordered_map< int, VjList > > ssrcvlist = cg.getSubsetSrcVjList();
-  cout << endl;
-  cout << "Construct data for encoding:\n";
-  for( auto sit = sidmap.begin(); sit != sidmap.end(); sit++ ) {
-    NodeSet s = sit->first;
-    SubsetSId id = sit->second;
-    cout << "Subset ";
-    CodeGeneration::printNodeSet( s );
-    cout << endl;
-    for( auto srcit = ssrcvlist[ id ].begin(); srcit != ssrcvlist[ id ].end(); srcit++ ) {
-      int src = srcit->first;
-      VjList dataList = srcit->second;
-      cout << "  Node " << src << ":\n";
-      for( unsigned int i = 0; i < dataList.size(); i++ ) {
-	Vj &vj = dataList[ i ];
-	cout << "    From data ";
-	CodeGeneration::printVpairList( vj.vpList );
-	cout << ", the " << vj.order << "th path is used for encoding.\n";
+    unsigned long long numFound = 0;
+    for( SubsetSId sid = 0; sid < numS; sid++ ) {
+      NodeMask mask = cg.getSubsetSMask( sid );
+      for( int rootId = 0; rootId <= R; rootId++ ) {
+	int pid = cg.getPlanPacketId( sid, rootId );
+	check( ( pid >= 0 ) == ( ( mask & CodeGeneration::nodeBit( node ) ) != 0 ), "packet of a subset without the node", K, R, node );
+	if( pid < 0 ) {
+	  continue;
+	}
+	numFound++;
+	PlanPacket& pp = packets[ pid ];
+	check( pp.sid == sid && pp.rootId == rootId && ( mask & CodeGeneration::nodeBit( pp.sender ) ), "wrong packet", K, R, node );
+	for( int s = 0; s < cg.getNumSegment(); s++ ) {
+	  PlanSegment& seg = segments[ pid * cg.getNumSegment() + s ];
+	  NodeMask inputIdx = mask & ~CodeGeneration::nodeBit( seg.dest );
+	  check( seg.dest != pp.sender && ( mask & CodeGeneration::nodeBit( seg.dest ) ), "wrong destination", K, R, node );
+	  check( cg.getNodeMaskFromFileID( seg.fid ) == inputIdx, "file not at the other nodes of the subset", K, R, node );
+	  check( seg.chunk < ( unsigned int ) R && ( int ) seg.block < eta, "chunk or block out of range", K, R, node );
+	}
       }
     }
+    check( numFound == packets.size(), "packets missing from the ids", K, R, node );
   }
+}
 
-  cout << endl;
-  cout << "Multicast scheduling:\n";
-  for( int k = 1; k <= cg.getK(); k++ ) {
-    cout << "Node " << k << " multicast:\n";
-    for( auto sit = nS.begin(); sit != nS.end(); sit++ ) {
-      NodeSet s = *sit;
-      if( s.find( k ) != s.end() ) {
-	cout << "  Subset ";
-	CodeGeneration::printNodeSet( s );
-	cout << endl;
-      }
-    }
-  }
 
-  cout << endl;
-  cout << "Subset contain:\n";
-  for( int i = 1; i <= cg.getK(); i++ ) {
-    cout << "  i = " << i << endl;
-    vector< NodeSet > ns = cg.getNodeSubsetSContain( i );
-    for( auto it = ns.begin(); it != ns.end(); it++ ) {
-      CodeGeneration::printNodeSet( *it );
-      cout << endl;
-    }
+int main( int argc, char* argv[] )
+{
+  int maxK = argc > 1 ? atoi( argv[ 1 ] ) : 8;
+  int eta = argc > 2 ? atoi( argv[ 2 ] ) : 2;
+  if( maxK < 2 || maxK > 16 || eta < 1 ) {
+    cout << "Usage: " << argv[ 0 ] << " [ largest K in [ 2, 16 ] ] [ Eta >= 1 ]\n";
+    return 1;
   }
 
-  cout << endl;
-  cout << "FileId to a set of nodes:\n";
-  for( unsigned long fid = 1; fid <= (unsigned int ) cg.getN(); fid++ ) {
-    cout << "  fid = " << fid << " : ";
-    NodeSet ns = cg.getNodeSetFromFileID( fid );
-    CodeGeneration::printNodeSet( ns );
-    cout << endl;
+  for( int K = 2; K <= maxK; K++ ) {
+    for( int R = 1; R < K; R++ ) {
+      testCode( K, R, eta );
+    }
   }
-  
-  return 0;
+  cout << ( numError == 0 ? "All codes are consistent\n" : "Errors found\n" );
+  return numError == 0 ? 0 : 1;
 }
-
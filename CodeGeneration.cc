@@ -7,180 +7,153 @@
 
 using namespace std;
 
+// Next subset of the same size in colexicographic order ( Gosper's hack )
+static NodeMask nextSubset( NodeMask mask )
+{
+  NodeMask low = mask & -mask;
+  NodeMask high = mask + low;
+  return ( ( ( high ^ mask ) >> 2 ) / low ) | high;
+}
+
+
+static NodeMask firstSubset( int size )
+{
+  return size >= 64 ? ~0ULL : ( 1ULL << size ) - 1;
+}
+
+
 CodeGeneration::CodeGeneration( int _N, int _K, int _R ): N( _N ), K( _K ), R( _R )
 {
-  NodeSubsetR = generateNodeSubset( R );
-  
-  if ( N % NodeSubsetR.size() != 0 ) {
-    cout << "N is not divisible by [K choose R]\n";
+  if ( K > 64 || R < 1 || R >= K ) {
+    cout << "K must be at most 64 and R in [ 1, K )\n";
     assert( false );
   }
-  Eta = N / NodeSubsetR.size();
-  constructM();
-  
-  // for( int nid = 1; nid <= K; nid++ ) {
-  //   NodeImMatrix[ nid ] = generateImMatrix( nid );
-  // }
-  
-  NodeSubsetS = generateNodeSubset( R + 1 );
-
-  for( unsigned int i = 0; i < NodeSubsetS.size(); i++ ) {
-    SubsetSIdMap[ NodeSubsetS[ i ] ] = i; 
-  }
 
-  for( int nid = 1; nid <= K; nid++ ) {
-    NodeSubsetSMap[ nid ] = generateNodeSubsetContain( nid, R + 1 );
+  Binom.assign( K + 1, vector< unsigned long long >( K + 2, 0 ) );
+  for( int n = 0; n <= K; n++ ) {
+    Binom[ n ][ 0 ] = 1;
+    for( int k = 1; k <= n; k++ ) {
+      Binom[ n ][ k ] = Binom[ n - 1 ][ k - 1 ] + Binom[ n - 1 ][ k ];
+    }
   }
 
-  unsigned long fid = 1;
-  for( auto nsit = NodeSubsetR.begin(); nsit != NodeSubsetR.end(); nsit++ ) {
-    FileNodeMap[ fid ] = *nsit;
-    NodeFileMap[ *nsit ] = fid;
-    fid++;
+  if ( N % getNumSubsetR() != 0 ) {
+    cout << "N is not divisible by [K choose R]\n";
+    assert( false );
   }
+  Eta = N / getNumSubsetR();
 }
 
 
-vector< NodeSet > CodeGeneration::generateNodeSubset( int r )
+unsigned long long CodeGeneration::rankSubset( NodeMask mask )
 {
-  vector< NodeSet > list;
-  vector< NodeSet > ret;
-  list.push_back( NodeSet() );
-  for( int i = 1; i <= K; i++ ) {
-    unsigned int numList = list.size();
-    for( unsigned int j = 0; j < numList; j++ ) {
-      NodeSet n( list[ j ] );
-      n.insert( i );
-      if( int( n.size() ) == r ) {
-	ret.push_back( n );
-      }
-      else {
-	list.push_back( n );
-      }
-    }
+  unsigned long long id = 0;
+  int j = 1;
+  while( mask != 0 ) {
+    int c = __builtin_ctzll( mask );
+    id += Binom[ c ][ j++ ];
+    mask &= mask - 1;
   }
-  return ret;
+  return id;
 }
 
 
-vector< NodeSet > CodeGeneration::generateNodeSubsetContain( int nodeId, int r )
+NodeMask CodeGeneration::unrankSubset( unsigned long long id, int size )
 {
-  set< int > nodes;
-  vector< NodeSet > list;
-  vector< NodeSet > ret;
-
-  for( int i = 1; i <= K; i++ ) {
-    if( i == nodeId ) {
-      NodeSet ns;
-      ns.insert( nodeId );
-      list.push_back( ns );
-      continue;
+  NodeMask mask = 0;
+  int c = K - 1;
+  for( int j = size; j >= 1; j-- ) {
+    while( Binom[ c ][ j ] > id ) {
+      c--;
     }
-    nodes.insert( i );
+    mask |= 1ULL << c;
+    id -= Binom[ c ][ j ];
+    c--;
   }
+  return mask;
+}
 
-  for( auto nit = nodes.begin(); nit != nodes.end(); nit++ ) {
-    int node = *nit;
-    unsigned lsize = list.size();
-    for( unsigned int i = 0; i < lsize; i++ ) {
-      NodeSet ns( list[ i ] );
-      ns.insert( node );
-      if( ns.size() == (unsigned int) r ) {
-	ret.push_back( ns );
-      }
-      else {
-	list.push_back( ns );
-      }
-    }
+
+NodeMask CodeGeneration::toNodeMask( const NodeSet& ns )
+{
+  NodeMask mask = 0;
+  for( auto nit = ns.begin(); nit != ns.end(); nit++ ) {
+    mask |= nodeBit( *nit );
   }
+  return mask;
+}
 
-  return ret;
+
+NodeSet CodeGeneration::toNodeSet( NodeMask mask )
+{
+  NodeSet ns;
+  while( mask != 0 ) {
+    ns.insert( __builtin_ctzll( mask ) + 1 );
+    mask &= mask - 1;
+  }
+  return ns;
 }
 
 
-void CodeGeneration::constructM()
+InputSet CodeGeneration::getM( int nodeId )
 {
-  int f = 1;  
-  for( auto it = NodeSubsetR.begin(); it != NodeSubsetR.end(); ++it ) {
-    NodeSet ns = *it;
-    for ( int count = 0; count < Eta; count++ ) {
-      for ( auto nit = ns.begin(); nit != ns.end(); ++nit ) {
-	int nid = *nit;
-	M[ nid ].insert( f );
+  // Eta consecutive files per subset of size R, in subset id order
+  InputSet inputs;
+  NodeMask mask = firstSubset( R );
+  unsigned long long num = getNumSubsetR();
+  for( unsigned long long id = 0; id < num; id++, mask = nextSubset( mask ) ) {
+    if( mask & nodeBit( nodeId ) ) {
+      for( int e = 0; e < Eta; e++ ) {
+	inputs.insert( id * Eta + e + 1 );
       }
-      f++;
     }
   }
+  return inputs;
 }
 
 
-ImMatrix CodeGeneration::generateImMatrix( int nid )
+void CodeGeneration::generatePlan( int nodeId )
 {
-  InputSet inputs = M[ nid ];
-  ImMatrix m( K, vector< bool >( N, false ) );
-  for( int q = 1; q <= K; q++ ) {
-    for( auto it = inputs.begin(); it != inputs.end(); ++it ) {
-      int inputIdx = *it;
-      m[ q - 1 ][ inputIdx - 1] = true;
+  // Only the Binom[ K - 1 ][ R ] subsets containing the node: R of the other K - 1 nodes,
+  // with the bit of the node inserted. This keeps the colexicographic order, so sids ascend.
+  planPacket.clear();
+  planSegment.clear();
+  planSubsetFirst.clear();
+  NodeMask low = nodeBit( nodeId ) - 1;
+  NodeMask other = firstSubset( R );
+  unsigned long long num = Binom[ K - 1 ][ R ];
+  for( unsigned long long i = 0; i < num; i++, other = nextSubset( other ) ) {
+    NodeMask mask = ( other & low ) | ( ( other & ~low ) << 1 ) | nodeBit( nodeId );
+    SubsetSId sid = rankSubset( mask );
+    planSubsetFirst[ sid ] = planPacket.size();
+    int rootId = 0;
+    for( NodeMask sm = mask; sm != 0; sm &= sm - 1, rootId++ ) {
+      int sender = __builtin_ctzll( sm ) + 1;
+      PlanPacket pp;
+      pp.sid = sid;
+      pp.sender = sender;
+      pp.rootId = rootId;
+      planPacket.push_back( pp );
+      for( int e = 0; e < Eta; e++ ) {
+	for( NodeMask dm = mask; dm != 0; dm &= dm - 1 ) {
+	  int dest = __builtin_ctzll( dm ) + 1;
+	  if( dest == sender ) {
+	    continue;
+	  }
+	  NodeMask inputIdx = mask & ~nodeBit( dest );
+	  PlanSegment seg;
+	  seg.dest = dest;
+	  seg.fid = getFileIDFromNodeMask( inputIdx ) + e;
+	  seg.chunk = __builtin_popcountll( inputIdx & ( nodeBit( sender ) - 1 ) );
+	  seg.block = e;
+	  planSegment.push_back( seg );
+	}
+      }
     }
   }
-  return m;
 }
 
 
-// void CodeGeneration::generateSubsetDestVpairList()
-// {
-//   for( auto it = SubsetSIdMap.begin(); it != SubsetSIdMap.end(); ++it ) {
-//     NodeSet s = it->first;
-//     SubsetSId id = it->second;
-//     for( auto kit = s.begin(); kit != s.end(); ++kit ) {
-//       int q = *kit;
-//       NodeSet t = s;
-//       t.erase( q );
-//       for( int n = 1; n <= N; n++ ) {
-// 	bool exclusive = true;	
-// 	if( NodeImMatrix[ q ][ q - 1 ][ n - 1 ] == true ) {
-// 	  exclusive = false;
-// 	}
-// 	else {
-// 	  for( auto jit = t.begin(); jit != t.end(); ++jit ) {
-// 	    int j = *jit;
-// 	    if( NodeImMatrix[ j ][ q - 1 ][ n - 1 ] == false ) {
-// 	      exclusive = false;
-// 	      break;
-// 	    }
-// 	  }
-// 	}
-// 	if( exclusive == true ) {
-// 	  SubsetDestVpairList[ id ][ q ].push_back( Vpair( q, n ) );
-// 	}
-//       }
-//     }
-//   }
-// }
-
-
-// void CodeGeneration::generateSubsetSrcVjList()
-// {
-//   for( auto it = SubsetSIdMap.begin(); it != SubsetSIdMap.end(); it++ ) {
-//     NodeSet s = it->first;
-//     SubsetSId id = it->second;
-//     for( auto kit = s.begin(); kit != s.end(); kit++ ) {
-//       int k = *kit;
-//       NodeSet t = s;
-//       t.erase( k );
-//       VpairList vpl = SubsetDestVpairList[ id ][ k ];
-//       int order = 1;
-//       for( auto jit = t.begin(); jit != t.end(); jit++ ) {
-// 	int j = *jit;
-// 	SubsetSrcVjList[ id ][ j ].push_back( Vj( vpl, k, order ) );
-// 	order++;
-//       }
-//     }
-//   }
-// }
-
-
 void CodeGeneration::printNodeSet( NodeSet ns )
 {
   cout << '{';
@@ -205,16 +178,3 @@ void CodeGeneration::printVpairList( VpairList vpl )
   }
   cout << " ]";
 }
-
-
-SubsetSId CodeGeneration::getSubsetSId( NodeSet ns )
-{
-  auto it = SubsetSIdMap.find( ns );
-  if( it != SubsetSIdMap.end() ) {
-    return it->second;
-  }
-  else {
-    cout << "Cannot find SubsetId\n";
-    assert( false );
-  }
-}
@@ -23,69 +23,80 @@ _Vj( VpairList vpl, int _dest, int _order ): vpList( vpl ), dest( _dest ), order
 } Vj;
 typedef vector< Vj > VjList;
 typedef unsigned int SubsetSId;
+typedef unsigned long long NodeMask; // bit ( i - 1 ) set if node i is in the subset, so K <= 64
 
+// Flat code plan of a node, see CodeGeneration::generatePlan
+typedef struct _PlanPacket {
+  SubsetSId sid;
+  int sender;
+  int rootId;  // rank of the sender in the multicast group of sid
+} PlanPacket;
+typedef struct _PlanSegment {
+  int dest;
+  unsigned long fid;   // one of the Eta files indexed by sid \ { dest }
+  unsigned int chunk;  // chunk of partition ( fid, dest ) encoded by the sender, in [ 0, R )
+  unsigned int block;  // sub-block of the packet, in [ 0, Eta )
+} PlanSegment;
+
+// Subsets of nodes are bitmasks. The id of a subset is its rank in the colexicographic
+// order of subsets of the same size ( combinatorial number system ), so ids and file ids
+// are computed from the mask and back without any table.
 class CodeGeneration {
  private:
   int N;
   int K;
   int R;
   int Eta;
-  vector< NodeSet > NodeSubsetR; // subset of nodes of size R
-  vector< NodeSet > NodeSubsetS; // subset of nodes of size R+1
-  map< NodeSet, SubsetSId > SubsetSIdMap;  
-  /* unordered_map< int, InputSet > M;  // Map: key = nodeId, value = files at the node */
-  /* unordered_map< int, ImMatrix > NodeImMatrix; */
-  map< int, InputSet > M;  // Map: key = nodeId, value = files at the node
-  map< int, ImMatrix > NodeImMatrix;  
+  vector< vector< unsigned long long > > Binom;  // Binom[ n ][ k ] = n choose k
 
-  /* unordered_map< SubsetSId, unordered_map< int, VpairList > > SubsetDestVpairList; */
-  /* unordered_map< SubsetSId, unordered_map< int, VjList > > SubsetSrcVjList; */
-
-  /* unordered_map< int, vector< NodeSet > > NodeSubsetSMap; // Map: key = nodeID, value = list of subset of size R+1 containing nodeId */
-  /* unordered_map< unsigned long, NodeSet > FileNodeMap; */
-  map< int, vector< NodeSet > > NodeSubsetSMap; // Map: key = nodeID, value = list of subset of size R+1 containing nodeId
-  map< unsigned long, NodeSet > FileNodeMap;  
-  map< NodeSet, unsigned long > NodeFileMap;
+  // Every packet of every subset containing the plan node, senders in ascending order.
+  // Packet p carries Eta sub-blocks, one per file of each destination, and segments
+  // [ p * R * Eta, ( p + 1 ) * R * Eta ), ordered by sub-block then destination.
+  vector< PlanPacket > planPacket;
+  vector< PlanSegment > planSegment;
+  unordered_map< SubsetSId, int > planSubsetFirst;  // first packet of each subset of the plan
 
  public:
   CodeGeneration( int _N, int _K, int _R );
   ~CodeGeneration() {}
   static void printNodeSet( NodeSet ns );
   static void printVpairList( VpairList vpl );
+  static NodeMask toNodeMask( const NodeSet& ns );
+  static NodeSet toNodeSet( NodeMask mask );
+  static NodeMask nodeBit( int nid ) { return 1ULL << ( nid - 1 ); }
 
-  vector< NodeSet >& getNodeSubsetR() { return NodeSubsetR; }
-  vector< NodeSet >& getNodeSubsetS() { return NodeSubsetS; }
-  map< NodeSet, SubsetSId >& getSubsetSIdMap() { return SubsetSIdMap; }
-  /* unordered_map< int, InputSet >& getM() { return M; } */
-  map< int, InputSet >& getM() { return M; }  
-  InputSet& getM( int nodeId ) { return M[ nodeId ]; }
-  /* unordered_map< int, ImMatrix >& getNodeImMatrix() { return NodeImMatrix; } */
-  map< int, ImMatrix >& getNodeImMatrix() { return NodeImMatrix; }
-  
-  /* unordered_map< SubsetSId, unordered_map< int, VpairList > >& getSubsetDestVpairList() { return SubsetDestVpairList; } */
-  /* unordered_map< SubsetSId, unordered_map< int, VjList > >& getSubsetSrcVjList() { return SubsetSrcVjList; } */
-  
   int getEta() { return Eta; }
   int getN() { return N; }
   int getK() { return K; }
   int getR() { return R; }
-  SubsetSId getSubsetSId( NodeSet ns );
-  NodeSet getSubsetSFromId( SubsetSId id ) { return NodeSubsetS[ id ]; }
-  vector< NodeSet >& getNodeSubsetSContain( int nid ) { return NodeSubsetSMap[ nid ]; }
-  NodeSet& getNodeSetFromFileID( unsigned long fid ) { return FileNodeMap[ fid ]; }
-  unsigned long getFileIDFromNodeSet( NodeSet ns ) { return NodeFileMap[ ns ]; }
+  unsigned long long getNumSubsetR() { return Binom[ K ][ R ]; }
+  unsigned long long getNumSubsetS() { return Binom[ K ][ R + 1 ]; }
 
- private:
-  vector< NodeSet > generateNodeSubset( int r );
-  void generateSubset( NodeSet preset, NodeSet remain, unsigned int size, vector< NodeSet >& list );
-  
-  void constructM();
-  ImMatrix generateImMatrix( int nid );
-  void generateSubsetDestVpairList();
-  void generateSubsetSrcVjList();
+  InputSet getM( int nodeId ); // files at the node
 
-  vector< NodeSet > generateNodeSubsetContain( int nodeId, int r );
+  SubsetSId getSubsetSId( NodeMask mask ) { return rankSubset( mask ); }
+  SubsetSId getSubsetSId( const NodeSet& ns ) { return rankSubset( toNodeMask( ns ) ); }
+  NodeMask getSubsetSMask( SubsetSId id ) { return unrankSubset( id, R + 1 ); }
+  NodeSet getSubsetSFromId( SubsetSId id ) { return toNodeSet( getSubsetSMask( id ) ); }
+  NodeMask getNodeMaskFromFileID( unsigned long fid ) { return unrankSubset( ( fid - 1 ) / Eta, R ); }
+  NodeSet getNodeSetFromFileID( unsigned long fid ) { return toNodeSet( getNodeMaskFromFileID( fid ) ); }
+  unsigned long getFileIDFromNodeMask( NodeMask mask ) { return rankSubset( mask ) * Eta + 1; } // first file of the subset
+  unsigned long getFileIDFromNodeSet( const NodeSet& ns ) { return getFileIDFromNodeMask( toNodeMask( ns ) ); }
+
+  void generatePlan( int nodeId );
+  vector< PlanPacket >& getPlanPacket() { return planPacket; }
+  vector< PlanSegment >& getPlanSegment() { return planSegment; }
+  int getNumSegment() { return R * Eta; } // segments per packet
+  int getPlanPacketId( SubsetSId sid, int rootId ) { // -1 if the node is not in the subset
+    auto fit = planSubsetFirst.find( sid );
+    return fit == planSubsetFirst.end() ? -1 : fit->second + rootId;
+  }
+
+ private:
+  unsigned long long rankSubset( NodeMask mask );
+  NodeMask unrankSubset( unsigned long long id, int size );
 };
 
 
+
 #endif
@@ -0,0 +1,237 @@
+#include <iostream>
+#include <cstdlib>
+#include <string>
+#include <cstring>
+#include <getopt.h>
+
+#include "CodedConfiguration.h"
+#include "BufferAllocator.h"
+
+using namespace std;
+
+bool CodedConfiguration::parseArgs( int argc, char* argv[] )
+{
+  static struct option longOptions[] = {
+    { "mode", required_argument, NULL, 'm' },
+    { "nodes", required_argument, NULL, 'K' },
+    { "load", required_argument, NULL, 'r' },
+    { "inputs", required_argument, NULL, 'N' },
+    { "input", required_argument, NULL, 'i' },
+    { "output", required_argument, NULL, 'o' },
+    { "partition", required_argument, NULL, 'p' },
+    { "samples", required_argument, NULL, 's' },
+    { "input-range", no_argument, NULL, 'R' },
+    { "distributed-sampling", no_argument, NULL, 'D' },
+    { "refine-splitters", no_argument, NULL, 'S' },
+    { "balance-epsilon", required_argument, NULL, 'E' },
+    { "cache-partitions", no_argument, NULL, 'P' },
+    { "capacity", required_argument, NULL, 'w' },
+    { "measure-capacity", no_argument, NULL, 'W' },
+    { "virtual-partitions", required_argument, NULL, 'v' },
+    { "sort-threads", required_argument, NULL, 't' },
+    { "memory-budget", required_argument, NULL, 'B' },
+    { "scratch", required_argument, NULL, 'x' },
+    { "stream", no_argument, NULL, 'X' },
+    { "stream-buffer", required_argument, NULL, 'b' },
+    { "stream-credits", required_argument, NULL, 'k' },
+    { "huge-pages", required_argument, NULL, 'H' },
+    { "numa-node", required_argument, NULL, 'n' },
+    { "touch-threads", required_argument, NULL, 'T' },
+    { "decode-threads", required_argument, NULL, 'd' },
+    { "encode-threads", required_argument, NULL, 'e' },
+    { "auto-load", no_argument, NULL, 'a' },
+    { "calibration-size", required_argument, NULL, 'C' },
+    { "report-memory", no_argument, NULL, 'M' },
+    { "help", no_argument, NULL, 'h' },
+    { NULL, 0, NULL, 0 }
+  };
+
+  bool setInput = false;
+  bool setOutput = false;
+  bool setPartition = false;
+  bool setNumInput = false;
+  unsigned int numCapacity = 0;
+  int opt;
+  optind = 1;
+  while( ( opt = getopt_long( argc, argv, "m:K:r:N:i:o:p:s:h", longOptions, NULL ) ) != -1 ) {
+    switch( opt ) {
+    case 'm':
+      if( string( optarg ) == "coded" ) {
+	coded = true;
+      }
+      else if( string( optarg ) == "uncoded" ) {
+	coded = false;
+      }
+      else {
+	cout << "Unknown mode " << optarg << endl;
+	return false;
+      }
+      break;
+    case 'K': numReducer = atoi( optarg ); break;
+    case 'r': load = atoi( optarg ); break;
+    case 'N': numInput = atoi( optarg ); setNumInput = true; break;
+    case 'i': setInputPath( optarg ); setInput = true; break;
+    case 'o': setOutputPath( optarg ); setOutput = true; break;
+    case 'p': setPartitionPath( optarg ); setPartition = true; break;
+    case 's': numSamples = atol( optarg ); break;
+    case 'R': readInputRange = true; break;
+    case 'D': distributedSampling = true; break;
+    case 'S': refineSplitter = true; break;
+    case 'E': balanceEpsilon = atof( optarg ); break;
+    case 'P': cachePartitions = true; break;
+    case 'w':
+      for( char* w = strtok( optarg, "," ); w != NULL; w = strtok( NULL, "," ) ) {
+	if( numCapacity == MAX_NODE || atof( w ) <= 0 ) {
+	  cout << "At most " << MAX_NODE << " positive capacities.\n";
+	  return false;
+	}
+	capacity[ numCapacity++ ] = atof( w );
+      }
+      break;
+    case 'W': measureCapacity = true; break;
+    case 'v': virtualPartition = atoi( optarg ); break;
+    case 't': numSortThread = atoi( optarg ); break;
+    case 'B': memoryBudget = atoll( optarg ); break;
+    case 'x': setScratchPath( optarg ); break;
+    case 'X': stream = true; break;
+    case 'b': streamBuffer = atoll( optarg ); break;
+    case 'k': streamCredit = atoi( optarg ); break;
+    case 'H':
+      if( string( optarg ) == "none" ) {
+	hugePage = HUGE_PAGE_NONE;
+      }
+      else if( string( optarg ) == "transparent" ) {
+	hugePage = HUGE_PAGE_TRANSPARENT;
+      }
+      else if( string( optarg ) == "explicit" ) {
+	hugePage = HUGE_PAGE_EXPLICIT;
+      }
+      else {
+	cout << "Unknown huge page mode " << optarg << endl;
+	return false;
+      }
+      break;
+    case 'n': numaNode = string( optarg ) == "local" ? NUMA_NODE_LOCAL : atoi( optarg ); break;
+    case 'T': numTouchThread = atoi( optarg ); break;
+    case 'd': numDecodeThread = atoi( optarg ); break;
+    case 'e': numEncodeThread = atoi( optarg ); break;
+    case 'a': autoLoad = true; readInputRange = true; break;
+    case 'C': calibrationSize = atoll( optarg ); break;
+    case 'M': reportMemory = true; break;
+    default: return false;
+    }
+  }
+  if( optind < argc ) {
+    cout << "Unexpected argument " << argv[ optind ] << endl;
+    return false;
+  }
+
+  // Defaults that depend on the mode and on K and r
+  if( !coded ) {
+    load = 1;
+    if( !setInput ) {
+      setInputPath( "./Input/Input10000" );
+    }
+    if( !setOutput ) {
+      setOutputPath( "./Output/Output10000" );
+    }
+    if( !setPartition ) {
+      setPartitionPath( "./Partition/Partition10000" );
+    }
+  }
+  if( numReducer < 2 || ( ( coded || autoLoad ) && numReducer > 64 ) ) {
+    cout << "The number of nodes must be in [ 2, 64 ].\n";
+    return false;
+  }
+  if( load < 1 || load >= numReducer ) {
+    cout << "The load must be in [ 1, K - 1 ].\n";
+    return false;
+  }
+  double binom = 1;
+  for( unsigned int i = 0; coded && i < load; i++ ) {
+    binom = binom * ( numReducer - i ) / ( i + 1 );
+  }
+  if( binom > 1e9 ) {
+    cout << "K choose r is too large for one input file per node subset.\n";
+    return false;
+  }
+  if( !setNumInput ) {
+    numInput = coded ? ( unsigned int ) ( binom + 0.5 ) : numReducer;
+  }
+  if( coded && !autoLoad && ( numInput == 0 || numInput % ( unsigned int ) ( binom + 0.5 ) != 0 ) ) {
+    cout << "N must be a multiple of K choose r = " << ( unsigned int ) ( binom + 0.5 ) << ".\n";
+    return false;
+  }
+  if( !coded && numInput != numReducer ) {
+    cout << "Uncoded TeraSort reads one input per node, N must be K.\n";
+    return false;
+  }
+  if( numCapacity > 0 && numCapacity != numReducer ) {
+    cout << "--capacity needs one weight per node.\n";
+    return false;
+  }
+  if( measureCapacity && numReducer > MAX_NODE ) {
+    cout << "--measure-capacity supports at most " << MAX_NODE << " nodes.\n";
+    return false;
+  }
+  if( virtualPartition < 1 || numSortThread < 1 ) {
+    cout << "--virtual-partitions and --sort-threads must be at least 1.\n";
+    return false;
+  }
+  if( numaNode < NUMA_NODE_LOCAL || numTouchThread < 1 ) {
+    cout << "--numa-node must be a node or local, --touch-threads at least 1.\n";
+    return false;
+  }
+  if( autoLoad && stream ) {
+    cout << "--auto-load may choose coded TeraSort, which has no --stream.\n";
+    return false;
+  }
+  if( stream && ( coded || refineSplitter || virtualPartition > 1 ) ) {
+    cout << "--stream applies to uncoded TeraSort without --refine-splitters or --virtual-partitions,\n"
+	 << "both need all keys before the first line is sent.\n";
+    return false;
+  }
+  if( stream && ( streamCredit < 1 || streamBuffer < getLineSize() ) ) {
+    cout << "--stream needs at least one credit and a buffer of one line.\n";
+    return false;
+  }
+  return true;
+}
+
+
+void CodedConfiguration::printUsage( const char* program )
+{
+  cout << "Usage: " << program << " [ options ]\n"
+       << "  -m, --mode coded|uncoded     algorithm ( coded )\n"
+       << "  -K, --nodes K                number of worker nodes, one process each besides the master ( 3 )\n"
+       << "  -r, --load r                 computation load of coded TeraSort ( 2 )\n"
+       << "  -N, --inputs N               number of input files, a multiple of K choose r ( K choose r, K if uncoded )\n"
+       << "  -i, --input PATH             input file, split files are PATH_0 ... PATH_N-1\n"
+       << "  -o, --output PATH            output files are PATH_0 ... PATH_K-1\n"
+       << "  -p, --partition PATH         partition file\n"
+       << "  -s, --samples n              keys sampled to choose the partitions ( 10000 )\n"
+       << "      --input-range            read input i as the i-th range of the input file, no split files needed\n"
+       << "      --distributed-sampling   workers sample their own inputs, the master only merges the samples\n"
+       << "      --refine-splitters       adjust the splitters on all keys after reading the inputs\n"
+       << "      --balance-epsilon e      refined partitions hold at most ( 1 + e ) times the average ( 0.01 )\n"
+       << "      --cache-partitions       save the splitters to the partition file, reuse them for the same input and K\n"
+       << "      --capacity w1,...,wK     relative speed of each node, partitions are proportional to it ( all 1 )\n"
+       << "      --measure-capacity       measure the capacities with a sort and map benchmark at start-up\n"
+       << "      --virtual-partitions c   sample c * K partitions, the master gives each node a range of them after map ( 1 )\n"
+       << "      --sort-threads n         threads sorting the partitions of a node in REDUCE ( 1 )\n"
+       << "      --memory-budget n        bytes of lines kept for REDUCE, sorted runs beyond it go to scratch ( 0 = no limit )\n"
+       << "      --scratch PATH           directory of the spilled runs ( /tmp )\n"
+       << "      --stream                 uncoded: send lines while mapping, in buffers per destination\n"
+       << "      --stream-buffer n        bytes of a stream buffer ( 1048576 )\n"
+       << "      --stream-credits n       buffers in flight to one destination ( 4 )\n"
+       << "      --huge-pages MODE        none, transparent or explicit 2 MB pages for the large buffers ( none )\n"
+       << "      --numa-node n|local      bind the large buffers to NUMA node n, or to the node of each worker\n"
+       << "      --touch-threads n        threads faulting in the pages of a new large buffer ( 1 )\n"
+       << "      --decode-threads n       threads decoding while shuffling, 0 decodes after the shuffle ( 1 )\n"
+       << "      --encode-threads n       threads encoding subsets in parallel ( 1 )\n"
+       << "      --auto-load              choose uncoded TeraSort or r from a calibration of the nodes,\n"
+       << "                               instead of --mode and --load, implies --input-range\n"
+       << "      --calibration-size n     bytes used by each calibration measurement ( 8000000 )\n"
+       << "      --report-memory          coded: peak resident memory of the workers in each phase\n"
+       << "  -h, --help                   this message\n";
+}
@@ -6,22 +6,48 @@
 class CodedConfiguration : public Configuration {
 
  private:
+  bool coded;
   unsigned int load;
-  
+  unsigned int numDecodeThread;
+  unsigned int numEncodeThread;
+  bool autoLoad;
+  unsigned long long calibrationSize;
+  bool reportMemory;
+
  public:
  CodedConfiguration(): Configuration() {
-    numInput = 3;    // N is assumed to be K choose r     
+    coded = true;    // coded or uncoded TeraSort, the uncoded one only uses the Configuration part
+    numInput = 3;    // N is a multiple of K choose r, Eta = N / ( K choose r ) files per subset
     numReducer = 3;  // K
-    load = 2;        // r    
-    
-    inputPath = "./Input/Input10000-C";
-    outputPath = "./Output/Output10000-C";
-    partitionPath = "./Partition/Partition10000-C";
-    numSamples = 10000;    
+    load = 2;        // r
+    numDecodeThread = 1;  // decode while shuffling, 0 = decode after shuffle
+    numEncodeThread = 1;  // threads encoding subsets in parallel
+    autoLoad = false;  // choose uncoded TeraSort or r at run time from a calibration ( Planner ), N = K choose r, needs readInputRange
+    calibrationSize = 8000000;  // bytes used by each calibration measurement
+    reportMemory = false;  // peak resident memory of the workers in each phase
+
+    setInputPath( "./Input/Input10000-C" );
+    setOutputPath( "./Output/Output10000-C" );
+    setPartitionPath( "./Partition/Partition10000-C" );
+    numSamples = 10000;
   }
   ~CodedConfiguration() {}
 
+  bool isCoded() const { return coded; }
   unsigned int getLoad() const { return load; }
+  unsigned int getNumDecodeThread() const { return numDecodeThread; }
+  unsigned int getNumEncodeThread() const { return numEncodeThread; }
+  bool getAutoLoad() const { return autoLoad; }
+  unsigned long long getCalibrationSize() const { return calibrationSize; }
+  bool getReportMemory() const { return reportMemory; }
+  void setCoded( bool _coded ) { coded = _coded; }
+  void setLoad( unsigned int _load ) { load = _load; }
+  void setNumDecodeThread( unsigned int _numDecodeThread ) { numDecodeThread = _numDecodeThread; }
+  void setNumEncodeThread( unsigned int _numEncodeThread ) { numEncodeThread = _numEncodeThread; }
+
+  // Command line options override the defaults above, false if they are not valid
+  bool parseArgs( int argc, char* argv[] );
+  static void printUsage( const char* program );
 };
 
 #endif
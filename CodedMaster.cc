@@ -6,7 +6,6 @@
 #include "CodedMaster.h"
 #include "Common.h"
 #include "CodedConfiguration.h"
-#include "PartitionSampling.h"
 
 using namespace std;
 
@@ -17,112 +16,102 @@ void CodedMaster::run()
     assert( false );
   }
 
-  // GENERATE LIST OF PARTITIONS.
-  PartitionSampling partitioner;
-  partitioner.setConfiguration( &conf );
-  PartitionList* partitionList = partitioner.createPartitions();
-
-
-  // BROADCAST CONFIGURATION TO WORKERS
-  MPI_Bcast(&conf, sizeof(Configuration), MPI_CHAR, 0, MPI_COMM_WORLD);
-  // Note: this works because the number of partitions can be derived from the number of workers in the configuration.
-
-
-  // BROADCAST PARTITIONS TO WORKERS
-  for (auto it = partitionList->begin(); it != partitionList->end(); it++) {
-    unsigned char* partition = *it;
-    MPI_Bcast(partition, conf.getKeySize() + 1, MPI_UNSIGNED_CHAR, 0, MPI_COMM_WORLD);
-  }
+  // CAPACITY, CONFIGURATION AND PARTITIONS TO THE WORKERS
+  setupPartitions();
 
 
   // TIME BUFFER
   int numWorker = conf.getNumReducer();
-  double rcvTime[ numWorker + 1 ];  
   double rTime = 0;
   double avgTime;
   double maxTime;
 
 
-  // COMPUTE CODE GENERATION TIME  
- MPI_Gather(&rTime, 1, MPI_DOUBLE, rcvTime, 1, MPI_DOUBLE, 0, MPI_COMM_WORLD);
-  avgTime = 0;
-  maxTime = 0;
-  for( int i = 1; i <= numWorker; i++ ) {
-    avgTime += rcvTime[ i ];
-    maxTime = max( maxTime, rcvTime[ i ] );
+  // COMPUTE CODE GENERATION TIME
+  gatherTime( "CODEGEN " );
+  cout << endl;
+
+
+  // ASSIGN VIRTUAL PARTITIONS FROM THE COUNTS OF THE MAP
+  if( conf.getVirtualPartition() > 1 ) {
+    partitioner.assignPartitions();
   }
-  cout << rank
-       << ": CODEGEN | Avg = " << setw(10) << avgTime/numWorker
-       << "   Max = " << setw(10) << maxTime << endl;
-      
+
 
   // COMPUTE MAP TIME
-  MPI_Gather(&rTime, 1, MPI_DOUBLE, rcvTime, 1, MPI_DOUBLE, 0, MPI_COMM_WORLD);
-  avgTime = 0;
-  maxTime = 0;
-  for( int i = 1; i <= numWorker; i++ ) {
-    avgTime += rcvTime[ i ];
-    maxTime = max( maxTime, rcvTime[ i ] );
-  }
-  cout << rank
-       << ": MAP     | Avg = " << setw(10) << avgTime/numWorker
-       << "   Max = " << setw(10) << maxTime << endl;  
+  gatherTime( "MAP     " );
+  printPred( pred.map );
+  cout << endl;  
 
   
   // COMPUTE ENCODE TIME
-  MPI_Gather(&rTime, 1, MPI_DOUBLE, rcvTime, 1, MPI_DOUBLE, 0, MPI_COMM_WORLD);
-  avgTime = 0;
-  maxTime = 0;
-  for( int i = 1; i <= numWorker; i++ ) {
-    avgTime += rcvTime[ i ];
-    maxTime = max( maxTime, rcvTime[ i ] );
-  }
-  cout << rank
-       << ": ENCODE  | Avg = " << setw(10) << avgTime/numWorker
-       << "   Max = " << setw(10) << maxTime << endl;  
+  gatherTime( "ENCODE  " );
+  printPred( pred.encode );
+  cout << endl;  
 
-  // COMPUTE SHUFFLE TIME
+  // COMPUTE SHUFFLE TIME ( multicasts of all nodes overlap, so the shuffle takes Max )
   avgTime = 0;
+  maxTime = 0;
   double txRate = 0;
   double avgRate = 0;
+  double shuffleByte[ 2 ];  // bytes sent, zero fill in them
+  double tolByte = 0;
+  double padByte = 0;
   for( int i = 1; i <= numWorker; i++ ) {
     MPI_Recv(&rTime, 1, MPI_DOUBLE, i, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
     avgTime += rTime;    
+    maxTime = max( maxTime, rTime );
     MPI_Recv(&txRate, 1, MPI_DOUBLE, i, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
     avgRate += txRate;
+    MPI_Recv(shuffleByte, 2, MPI_DOUBLE, i, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    tolByte += shuffleByte[ 0 ];
+    padByte += shuffleByte[ 1 ];
   }
   cout << rank
-       << ": SHUFFLE | Sum = " << setw(10) << avgTime
-       << "   Rate = " << setw(10) << avgRate/numWorker << " Mbps" << endl;
+       << ": SHUFFLE | Avg = " << setw(10) << avgTime/numWorker
+       << "   Max = " << setw(10) << maxTime
+       << "   Rate = " << setw(10) << avgRate/numWorker << " Mbps"
+       << "   Pad = " << setw(6) << ( tolByte > 0 ? 100 * padByte / tolByte : 0 ) << " %";
+  printPred( pred.shuffle );
+  cout << endl;
 
 
   // COMPUTE DECODE TIME
-  MPI_Gather(&rTime, 1, MPI_DOUBLE, rcvTime, 1, MPI_DOUBLE, 0, MPI_COMM_WORLD); 
-  avgTime = 0;
-  maxTime = 0;
-  for( int i = 1; i <= numWorker; i++ ) {
-    avgTime += rcvTime[ i ];
-    maxTime = max( maxTime, rcvTime[ i ] );
-  }
-  cout << rank
-       << ": DECODE  | Avg = " << setw(10) << avgTime/numWorker
-       << "   Max = " << setw(10) << maxTime << endl;  
+  gatherTime( "DECODE  " );
+  printPred( pred.decode );
+  cout << endl;  
 
   // COMPUTE REDUCE TIME
-  MPI_Gather(&rTime, 1, MPI_DOUBLE, rcvTime, 1, MPI_DOUBLE, 0, MPI_COMM_WORLD);
-  avgTime = 0;
-  maxTime = 0;
-  for( int i = 1; i <= numWorker; i++ ) {
-    avgTime += rcvTime[ i ];
-    maxTime = max( maxTime, rcvTime[ i ] );
-  }
-  cout << rank
-       << ": REDUCE  | Avg = " << setw(10) << avgTime/numWorker
-       << "   Max = " << setw(10) << maxTime << endl;      
-  
-
-  // CLEAN UP MEMORY
-  for ( auto it = partitionList->begin(); it != partitionList->end(); it++ ) {
-    delete [] *it;
+  gatherTime( "REDUCE  " );
+  printPred( pred.reduce );
+  cout << endl;      
+
+
+  // PEAK MEMORY OF THE WORKERS IN EACH PHASE
+  if( conf.getReportMemory() ) {
+    const int numPhase = 5;
+    const char* phaseName[ numPhase ] = { "MAP    ", "ENCODE ", "SHUFFLE", "DECODE ", "REDUCE " };
+    double phaseMemory[ numPhase ] = { 0 };
+    double rcvMemory[ ( numWorker + 1 ) * numPhase ];
+    MPI_Gather( phaseMemory, numPhase, MPI_DOUBLE, rcvMemory, numPhase, MPI_DOUBLE, 0, MPI_COMM_WORLD );
+    bool valid = true;
+    for( int i = 1; i <= numWorker; i++ ) {
+      valid = valid && rcvMemory[ i * numPhase ] >= 0;
+    }
+    if( !valid ) {
+      cout << rank << ": MEMORY  | not available, a worker cannot reset its peak resident memory\n";
+    }
+    for( int p = 0; valid && p < numPhase; p++ ) {
+      double avgMemory = 0;
+      double maxMemory = 0;
+      for( int i = 1; i <= numWorker; i++ ) {
+	avgMemory += rcvMemory[ i * numPhase + p ];
+	maxMemory = max( maxMemory, rcvMemory[ i * numPhase + p ] );
+      }
+      cout << rank
+	   << ": MEMORY  | " << phaseName[ p ]
+	   << "   Avg = " << setw(10) << avgMemory/numWorker << " MB"
+	   << "   Max = " << setw(10) << maxMemory << " MB" << endl;
+    }
   }
 }
@@ -1,20 +1,25 @@
 #ifndef _CMR_MASTER
 #define _CMR_MASTER
 
+#include <cstddef>
+
 #include "CodedConfiguration.h"
+#include "MasterBase.h"
 
-class CodedMaster
+class CodedMaster: public MasterBase
 {
  private:
   CodedConfiguration conf;
-  unsigned int rank;
-  unsigned int totalNode;
 
  public:
- CodedMaster( unsigned int _rank, unsigned int _totalNode ): rank( _rank ), totalNode( _totalNode ) {};
+ CodedMaster( unsigned int _rank, unsigned int _totalNode, const CodedConfiguration& _conf ): MasterBase( _rank, _totalNode ), conf( _conf ) {};
   ~CodedMaster() {};
 
   void run();
+
+ protected:
+  Configuration* getConfiguration() { return &conf; }
+  size_t getConfigurationSize() const { return sizeof( CodedConfiguration ); }
 };
 
 #endif
@@ -10,131 +10,126 @@
 #include <ctime>
 #include <string.h>
 #include <cstdint>
+#include <sched.h>
+#include <unistd.h>
 
 #include "CodedWorker.h"
 #include "CodedConfiguration.h"
 #include "Common.h"
 #include "Utility.h"
 #include "CodeGeneration.h"
+#include "XorKernel.h"
+#include "ThreadPool.h"
+#include "BufferAllocator.h"
+#include "MulticastScheduler.h"
+
+#define ENCODE_BLOCK_SIZE 1048576  // bytes of an encoding task
 
 using namespace std;
 
 CodedWorker::~CodedWorker()
 {
-  for ( auto it = partitionList.begin(); it != partitionList.end(); ++it ) {
-    delete [] *it;
-  }
-
-  // Delete from inputPartitionCollection
-  InputSet inputSet = cg->getM( rank );
-  for ( auto init = inputSet.begin(); init != inputSet.end(); init++ ) {
-    unsigned int inputId = *init;
-    LineList* list = inputPartitionCollection[ inputId ][ rank - 1 ];
-    for ( auto lit = list->begin(); lit != list->end(); lit++ ) {
-      delete [] *lit;
-    }
-    delete list;
-  }  
-
-  // Delete from encodePreData
-  for ( auto it = encodePreData.begin(); it != encodePreData.end(); it++ ) {
-    DataPartMap dp = it->second;
-    for ( auto it2 = dp.begin(); it2 != dp.end(); it2++ ) {
-      vector< DataChunk >& vdc = it2->second;
-      for ( auto dcit = vdc.begin(); dcit != vdc.end(); dcit++ ) {
-	delete [] dcit->data;
-      }
+  // Delete from inputPartitionCollection ( planChunk only points into it, into packets and into localArena ).
+  // Own partitions are also part of localList, partitions freed by decoding are NULL.
+  for ( auto init = inputPartitionCollection.begin(); init != inputPartitionCollection.end(); init++ ) {
+    PartitionCollection& pc = init->second;
+    for ( auto pit = pc.begin(); pit != pc.end(); pit++ ) {
+      freeBuffer( pit->second.data );
     }
   }
+  delete [] sideChunkUse;
 
-  // Delete from localList
-  for ( auto it = localList.begin(); it != localList.end(); ++it ) {
-     delete [] *it;
+  for ( auto mit = multicastGroupMap.begin(); mit != multicastGroupMap.end(); mit++ ) {
+    MPI_Comm_free( &mit->second );
   }
 
-  delete trie;    
   delete cg;
   delete conf;
 }
 
 void CodedWorker::run()
 {
-  // RECEIVE CONFIGURATION FROM MASTER
-  conf = new CodedConfiguration;
+  // MEASURE CAPACITY FOR THE PARTITIONS OF THE MASTER
+  if( conf->getMeasureCapacity() ) {
+    execCapacity();
+  }
+
+  // RECEIVE CONFIGURATION FROM MASTER ( r and N may have been chosen at run time )
   MPI_Bcast((void*)conf, sizeof(CodedConfiguration), MPI_CHAR, 0, MPI_COMM_WORLD);
 
-  // RECEIVE PARTITIONS FROM MASTER
-  for ( unsigned int i = 1; i < conf->getNumReducer(); i++ ) {
-    unsigned char* buff = new unsigned char[ conf->getKeySize() + 1 ];
-    MPI_Bcast(buff, conf->getKeySize() + 1, MPI_UNSIGNED_CHAR, 0, MPI_COMM_WORLD);
-    partitionList.push_back( buff );
+  // SAMPLE OWN INPUTS FOR THE MASTER
+  cg = new CodeGeneration( conf->getNumInput(), conf->getNumReducer(), conf->getLoad() );
+  if( conf->getDistributedSampling() ) {
+    execSampling( getSampleInputs() );
   }
 
-  clock_t time;
+  // RECEIVE PARTITIONS FROM MASTER
+  receivePartitions();
+
+  // Wall-clock timers: CPU time would also count the decoder threads
+  double time;
   double rTime;  
 
   
-  // GENERATE CODING SCHEME AND MULTICAST GROUPS
-  time = clock();
-  cg = new CodeGeneration( conf->getNumInput(), conf->getNumReducer(), conf->getLoad() );
-  genMulticastGroup();
-  time = clock() - time;
-  rTime = double( time ) / CLOCKS_PER_SEC;
-  MPI_Gather(&rTime, 1, MPI_DOUBLE, rcvTime, 1, MPI_DOUBLE, 0, MPI_COMM_WORLD);    
+  // GENERATE CODING SCHEME ( multicast groups are created by the shuffle when first used )
+  time = MPI_Wtime();
+  cg->generatePlan( rank );
+  rTime = MPI_Wtime() - time;
+  MPI_Gather(&rTime, 1, MPI_DOUBLE, NULL, 1, MPI_DOUBLE, 0, MPI_COMM_WORLD);    
 
   
   // EXECUTE MAP PHASE
-  time = clock();
+  restartPhaseMemory();
+  time = MPI_Wtime();
   execMap();
-  time = clock() - time;
-  rTime = double( time ) / CLOCKS_PER_SEC;  
-  MPI_Gather(&rTime, 1, MPI_DOUBLE, rcvTime, 1, MPI_DOUBLE, 0, MPI_COMM_WORLD);       
+  exchangePartitionSize();
+  newPartitionSlice();
+  rTime = MPI_Wtime() - time;
+  markPhaseMemory();
+  MPI_Gather(&rTime, 1, MPI_DOUBLE, NULL, 1, MPI_DOUBLE, 0, MPI_COMM_WORLD);       
 
 
   // EXECUTE ENCODING PHASE
-  time = clock();
+  time = MPI_Wtime();
   execEncoding();
-  time = clock() - time;
-  rTime = double( time ) / CLOCKS_PER_SEC;
-  MPI_Gather(&rTime, 1, MPI_DOUBLE, rcvTime, 1, MPI_DOUBLE, 0, MPI_COMM_WORLD);       
+  rTime = MPI_Wtime() - time;
+  markPhaseMemory();
+  MPI_Gather(&rTime, 1, MPI_DOUBLE, NULL, 1, MPI_DOUBLE, 0, MPI_COMM_WORLD);       
 
 
-  // // START PARALLEL DECODE 
-  // // maxDecodeJob = ( cg->getNodeSubsetS().size() * ( cg->getR() * ( cg->getR() + 1 ) ) ) / cg->getK();
-  // // int tid = pthread_create( &decodeThread, NULL, parallelDecoder, (void*) this );
-  // // if( tid ) {
-  // //   cout << rank << ": ERROR -- cannot create parallel decoder thread\n";
-  // //   assert( false );
-  // // }
+  // START PARALLEL DECODE
+  if( conf->getNumDecodeThread() > 0 ) {
+    startParallelDecoder();
+  }
 
   
   // SHUFFLING PHASE
-  //time = clock();
   execShuffle();
-  //time = clock() - time;
-  //cout << rank << ": Shuffle phase takes " << double( time ) / CLOCKS_PER_SEC << " seconds.\n";
+  markPhaseMemory();
 
 
-  // EXECUTE DECODING PHASE
-  time = clock();
+  // EXECUTE DECODING PHASE ( only what is left after the shuffle when decoding in parallel )
+  time = MPI_Wtime();
   execDecoding();
-  time = clock() - time;
-  rTime = double( time ) / CLOCKS_PER_SEC;
-  MPI_Gather(&rTime, 1, MPI_DOUBLE, rcvTime, 1, MPI_DOUBLE, 0, MPI_COMM_WORLD);       
-
-  // // // WAIT UNTIL PARALLEL DECODING IS DONE
-  // // time = clock();  
-  // // pthread_join( decodeThread, NULL );
-  // // time = clock() - time;
-  // // cout << rank << ": Additional decoding phase takes " << double( time ) / CLOCKS_PER_SEC << " seconds.\n";    
+  rTime = MPI_Wtime() - time;
+  markPhaseMemory();
+  MPI_Gather(&rTime, 1, MPI_DOUBLE, NULL, 1, MPI_DOUBLE, 0, MPI_COMM_WORLD);       
 
 
   // REDUCE PHASE
-  time = clock();
+  time = MPI_Wtime();
   execReduce();
-  time = clock() - time;
-  rTime = double( time ) / CLOCKS_PER_SEC;  
-  MPI_Gather(&rTime, 1, MPI_DOUBLE, rcvTime, 1, MPI_DOUBLE, 0, MPI_COMM_WORLD); 
+  rTime = MPI_Wtime() - time;
+  markPhaseMemory();
+  MPI_Gather(&rTime, 1, MPI_DOUBLE, NULL, 1, MPI_DOUBLE, 0, MPI_COMM_WORLD); 
+
+  // PEAK MEMORY OF MAP, ENCODE, SHUFFLE, DECODE AND REDUCE
+  if( conf->getReportMemory() ) {
+    if( !phaseMemoryValid ) {
+      phaseMemory.assign( phaseMemory.size(), -1 );
+    }
+    MPI_Gather( &phaseMemory[ 0 ], phaseMemory.size(), MPI_DOUBLE, NULL, phaseMemory.size(), MPI_DOUBLE, 0, MPI_COMM_WORLD );
+  }
   
   outputLocalList();
   //printLocalList();
@@ -153,374 +148,465 @@ unsigned int CodedWorker::findAssociatePartition( const unsigned char* line )
 }
 
 
+vector< unsigned int > CodedWorker::getSampleInputs()
+{
+  // Each file is on r nodes, they take turns so that every file is sampled once
+  vector< unsigned int > inputs;
+  InputSet inputSet = cg->getM( rank );
+  for ( auto init = inputSet.begin(); init != inputSet.end(); init++ ) {
+    unsigned int inputId = *init;
+    NodeMask mask = cg->getNodeMaskFromFileID( inputId );
+    unsigned int turn = ( inputId - 1 ) % conf->getLoad();
+    unsigned int node = 1;
+    for ( ; node <= conf->getNumReducer(); node++ ) {
+      if ( ( mask & CodeGeneration::nodeBit( node ) ) && turn-- == 0 ) {
+	break;
+      }
+    }
+    if ( node == rank ) {
+      inputs.push_back( inputId );
+    }
+  }
+  return inputs;
+}
+
+
 void CodedWorker::execMap()
 {
   // Get a set of inputs to be processed
   InputSet inputSet = cg->getM( rank );
 
-  // Build trie
-  unsigned char prefix[ conf->getKeySize() ];
-  trie = buildTrie( &partitionList, 0, partitionList.size(), prefix, 0, 2 );
+  // Refining and virtual partitions need all keys before any line is stored, so read all inputs first.
+  // Each file is counted by one of the r nodes having it, as in sampling.
+  bool readAll = conf->getRefineSplitter() || conf->getVirtualPartition() > 1;
+  map< unsigned int, pair< unsigned char*, unsigned long long > > inputData;
+  vector< unsigned int > owned = getSampleInputs();
+  unsigned long long lineSize = conf->getLineSize();
+  if ( readAll ) {
+    for ( auto init = inputSet.begin(); init != inputSet.end(); init++ ) {
+      unsigned long long numLine;
+      unsigned char* fileBuff = readInput( *init, numLine );
+      inputData[ *init ] = make_pair( fileBuff, numLine );
+    }
+  }
+  if ( conf->getRefineSplitter() ) {
+    vector< unsigned char* > data;
+    vector< unsigned long long > numLine;
+    for ( auto it = owned.begin(); it != owned.end(); ++it ) {
+      data.push_back( inputData[ *it ].first );
+      numLine.push_back( inputData[ *it ].second );
+    }
+    refineSplitters( data, numLine );
+  }
+
+  // Virtual partitions of every line, the master then chooses their nodes from the counts
+  map< unsigned int, vector< unsigned int > > inputWid;
+  if ( conf->getVirtualPartition() > 1 ) {
+    vector< unsigned long long > count( conf->getNumPartition(), 0 );
+    for ( auto init = inputSet.begin(); init != inputSet.end(); init++ ) {
+      unsigned char* fileBuff = inputData[ *init ].first;
+      unsigned long long numLine = inputData[ *init ].second;
+      vector< unsigned int >& lineWid = inputWid[ *init ];
+      lineWid.resize( numLine );
+      for ( unsigned long i = 0; i < numLine; i++ ) {
+	lineWid[ i ] = findPartition( fileBuff + i * lineSize, ( ( unsigned long long ) *init << 40 ) + i );
+      }
+      if ( find( owned.begin(), owned.end(), *init ) != owned.end() ) {
+	for ( unsigned long i = 0; i < numLine; i++ ) {
+	  count[ lineWid[ i ] ]++;
+	}
+      }
+    }
+    receiveAssignment( count );
+  }
 
   // Read input files and partition data
   for ( auto init = inputSet.begin(); init != inputSet.end(); init++ ) {
     unsigned int inputId = *init;
 
     // Read input
-    char filePath[ MAX_FILE_PATH ];
-    sprintf( filePath, "%s_%d", conf->getInputPath(), inputId - 1 );
-    ifstream inputFile( filePath, ios::in | ios::binary | ios::ate );
-    if ( !inputFile.is_open() ) {
-      cout << rank << ": Cannot open input file " << filePath << endl;
-      assert( false );
+    unsigned long long numLine;
+    unsigned char* fileBuff;
+    if ( readAll ) {
+      fileBuff = inputData[ inputId ].first;
+      numLine = inputData[ inputId ].second;
+    }
+    else {
+      fileBuff = readInput( inputId, numLine );
     }
-
-    unsigned long fileSize = inputFile.tellg();
-    unsigned long int lineSize = conf->getLineSize();
-    unsigned long int numLine = fileSize / lineSize;
-    inputFile.seekg( 0, ios::beg );
     PartitionCollection& pc = inputPartitionCollection[ inputId ];
 
-    // Crate lists of lines
-    for ( unsigned int i = 0; i < conf->getNumReducer(); i++ ) {
-      pc[ i ] = new LineList;
-      // inputPartitionCollection[ inputId ][ i ] = new LineList;
+    // Partition data in the input file, wid is the node of the partition
+    vector< unsigned int > lineWid( numLine );
+    vector< unsigned long long > count( conf->getNumReducer(), 0 );
+    if ( conf->getVirtualPartition() > 1 ) {
+      lineWid.swap( inputWid[ inputId ] );
+      for ( unsigned long i = 0; i < numLine; i++ ) {
+	lineWid[ i ] = partitionOwner[ lineWid[ i ] ];
+	count[ lineWid[ i ] ]++;
+      }
     }
-    
-    // Partition data in the input file
-    for ( unsigned long i = 0; i < numLine; i++ ) {
-      unsigned char* buff = new unsigned char[ lineSize ];
-      inputFile.read( ( char * ) buff, lineSize );
-      unsigned int wid = trie->findPartition( buff );
-      pc[ wid ]->push_back( buff );      
-      // inputPartitionCollection[ inputId ][ wid ]->push_back( buff );
+    else {
+      for ( unsigned long i = 0; i < numLine; i++ ) {
+	unsigned int wid = findPartition( fileBuff + i * lineSize, ( ( unsigned long long ) inputId << 40 ) + i );
+	lineWid[ i ] = wid;
+	count[ wid ]++;
+      }
     }
 
-    // Remove unnecessarily lists (partitions associated with the other nodes having the file)
-    NodeSet fsIndex = cg->getNodeSetFromFileID( inputId );
+    // Keep only partitions this node needs: its own and those of nodes not having the file.
+    // Each partition is contiguous, so the r chunks used by encoding are just offsets into it.
+    NodeMask fsIndex = cg->getNodeMaskFromFileID( inputId );
+    vector< unsigned char* > wptr( conf->getNumReducer(), NULL );
     for ( unsigned int i = 0; i < conf->getNumReducer(); i++ ) {
-      if( i + 1 != rank && fsIndex.find( i + 1 ) != fsIndex.end() ) {
-	LineList* list = pc[ i ];
-	// LineList* list = inputPartitionCollection[ inputId ][ i ];
-	for ( auto lit = list->begin(); lit != list->end(); lit++ ) {
-	  delete [] *lit;
-	}
-	delete list;	
+      if( i + 1 != rank && ( fsIndex & CodeGeneration::nodeBit( i + 1 ) ) ) {
+	continue;
       }
+      DataChunk& dc = pc[ i ];
+      dc.data = allocBuffer( count[ i ] * lineSize );
+      dc.size = count[ i ];
+      wptr[ i ] = dc.data;
     }
-
-    inputFile.close();
+    for ( unsigned long i = 0; i < numLine; i++ ) {
+      unsigned int wid = lineWid[ i ];
+      if ( wptr[ wid ] != NULL ) {
+	memcpy( wptr[ wid ], fileBuff + i * lineSize, lineSize );
+	wptr[ wid ] += lineSize;
+      }
+    }
+    freeBuffer( fileBuff );
   }
 
   //writeInputPartitionCollection();
 }
 
 
-void CodedWorker::execEncoding()
+void CodedWorker::exchangePartitionSize()
 {
-  vector< NodeSet > subsetS = cg->getNodeSubsetSContain( rank );
-  unsigned lineSize = conf->getLineSize();
-  for( auto nsit = subsetS.begin(); nsit != subsetS.end(); nsit++ ) {
-    SubsetSId nsid = cg->getSubsetSId( *nsit );
-    unsigned long long maxSize = 0;
-    
-    // Construct chucks of input from data with index ns\{q}
-    for( auto qit = nsit->begin(); qit != nsit->end(); qit++ ) {
-      if( (unsigned int) *qit == rank ) {
-	continue;
+  // Every node holding a file computes the same partition sizes, so MAX fills the whole table.
+  // Receivers then know the size of every coded packet without asking its sender.
+  unsigned int numReducer = conf->getNumReducer();
+  partitionSize.assign( conf->getNumInput() * numReducer, 0 );
+  for( auto init = inputPartitionCollection.begin(); init != inputPartitionCollection.end(); init++ ) {
+    for( auto pit = init->second.begin(); pit != init->second.end(); pit++ ) {
+      partitionSize[ ( init->first - 1 ) * numReducer + pit->first ] = pit->second.size;
+    }
+  }
+  MPI_Allreduce( MPI_IN_PLACE, &partitionSize[ 0 ], partitionSize.size(), MPI_UNSIGNED_LONG_LONG, MPI_MAX, workerComm );
+}
+
+
+void CodedWorker::newPartitionSlice()
+{
+  // Without a memory budget the partitions this node receives are laid out in fid order in one buffer.
+  // Own partitions are not copied, localList also points into them where map put them.
+  if( conf->getMemoryBudget() > 0 ) {
+    return;
+  }
+  unsigned int partitionId = rank - 1;
+  unsigned long long lineSize = conf->getLineSize();
+  unsigned long long numLine = 0;
+  for( unsigned int fid = 1; fid <= conf->getNumInput(); fid++ ) {
+    if( inputPartitionCollection.find( fid ) == inputPartitionCollection.end() ) {
+      numLine += partitionSize[ ( fid - 1 ) * conf->getNumReducer() + partitionId ];
+    }
+  }
+  unsigned char* arena = newLocalArena( numLine );
+  partitionSlice.resize( conf->getNumInput() );
+  for( unsigned int fid = 1; fid <= conf->getNumInput(); fid++ ) {
+    auto init = inputPartitionCollection.find( fid );
+    if( init != inputPartitionCollection.end() ) {
+      DataChunk& partition = init->second[ partitionId ];
+      partitionSlice[ fid - 1 ] = partition.data;
+      for( unsigned long long l = 0; l < partition.size; l++ ) {
+	localList.push_back( partition.data + l * lineSize );
       }
-      int destId = *qit;      
-      NodeSet inputIdx( *nsit );
-      inputIdx.erase( destId );
-      
-      unsigned long fid = cg->getFileIDFromNodeSet( inputIdx );
-      VpairList vplist;      
-      vplist.push_back( Vpair( destId, fid ) );
-      
-      unsigned int partitionId = destId - 1;
-      
-      LineList* ll = inputPartitionCollection[ fid ][ partitionId ];
-
-      auto lit = ll->begin();
-      unsigned int numPart = conf->getLoad();
-      unsigned long long chunkSize = ll->size() / numPart; // a number of lines ( not bytes )
-      // first chunk to second last chunk
-      for( unsigned int ci = 0; ci < numPart - 1; ci++ ) {
-	unsigned char* chunk = new unsigned char[ chunkSize * lineSize ];
-	for( unsigned long long j = 0; j < chunkSize; j++ ) {
-	  memcpy( chunk + j * lineSize, *lit, lineSize );
-	  lit++;
-	}
-	DataChunk dc;
-	dc.data = chunk;
-	dc.size = chunkSize;
-	encodePreData[ nsid ][ vplist ].push_back( dc );
-      }
-      // last chuck
-      unsigned long long lastChunkSize = ll->size() - chunkSize * ( numPart - 1 );      
-      unsigned char* chunk = new unsigned char[ lastChunkSize * lineSize ];
-      for( unsigned long long j = 0; j < lastChunkSize; j++ ) {
-	memcpy( chunk + j * lineSize, *lit, lineSize );
-	lit++;
-      }
-      DataChunk dc;
-      dc.data = chunk;
-      dc.size = lastChunkSize;
-      encodePreData[ nsid ][ vplist ].push_back( dc );
-
-      // Determine associated chunk of a worker ( order in ns )
-      unsigned int rankChunk = 0;  // in [ 0, ... , r - 1 ]
-      for( auto it = inputIdx.begin(); it != inputIdx.end(); it++ ) {
-	if( (unsigned int) *it == rank ) {
-	  break;
+    }
+    else {
+      partitionSlice[ fid - 1 ] = arena;
+      arena += partitionSize[ ( fid - 1 ) * conf->getNumReducer() + partitionId ] * lineSize;
+    }
+  }
+}
+
+
+void CodedWorker::balanceSegment()
+{
+  // In a subset S and sub-block e, partition P_d ( d in S ) is split by bytes among the r senders in S \ { d }.
+  // Sender s sends L_s = T - |P_s| bytes with T = max( ceil( sum |P| / r ), max |P| ), so the r chunks
+  // XORed by every sender have the same length unless one partition holds more than 1 / r of the bytes.
+  // Every node computes the same split from the partition size table.
+  vector< PlanPacket >& planPacket = cg->getPlanPacket();
+  vector< PlanSegment >& planSegment = cg->getPlanSegment();
+  unsigned int numSeg = cg->getNumSegment();
+  unsigned int numDest = conf->getLoad();
+  unsigned int numSender = numDest + 1;
+  unsigned int eta = cg->getEta();
+  unsigned long long lineSize = conf->getLineSize();
+  segOffset.assign( planSegment.size(), 0 );
+  segSize.assign( planSegment.size(), 0 );
+  blockSize.assign( planPacket.size() * eta, 0 );
+  padSize = 0;
+
+  // Packets first, ..., first + r are the senders of one subset in ascending order
+  for( unsigned int first = 0; first < planPacket.size(); first += numSender ) {
+    for( unsigned int e = 0; e < eta; e++ ) {
+      // Segment of sender j for the node at position d of the subset
+      auto segId = [ & ]( unsigned int j, unsigned int d ) { return ( first + j ) * numSeg + e * numDest + ( d < j ? d : d - 1 ); };
+
+      unsigned long long part[ numSender ];  // bytes of partition P_d
+      unsigned long long total = 0;
+      unsigned long long maxPart = 0;
+      for( unsigned int d = 0; d < numSender; d++ ) {
+	PlanSegment& seg = planSegment[ segId( d == 0 ? 1 : 0, d ) ];
+	part[ d ] = partitionSize[ ( seg.fid - 1 ) * conf->getNumReducer() + seg.dest - 1 ] * lineSize;
+	total += part[ d ];
+	maxPart = max( maxPart, part[ d ] );
+      }
+      unsigned long long T = max( ( total + numDest - 1 ) / numDest, maxPart );
+      for( unsigned int j = 0; j < numSender; j++ ) {
+	blockSize[ ( first + j ) * eta + e ] = T - part[ j ];
+      }
+
+      // Fill senders in ascending order, each up to its packet length
+      for( unsigned int d = 0; d < numSender; d++ ) {
+	unsigned long long offset = 0;
+	for( unsigned int j = 0; j < numSender; j++ ) {
+	  if( j == d ) {
+	    continue;
+	  }
+	  unsigned long long x = min( T - part[ j ], part[ d ] - offset );
+	  segOffset[ segId( j, d ) ] = offset;
+	  segSize[ segId( j, d ) ] = x;
+	  offset += x;
 	}
-	rankChunk++;
       }
-      maxSize = max( maxSize, encodePreData[ nsid ][ vplist ][ rankChunk ].size );
 
-      // Remode unused intermediate data from Map
-      for( auto lit = ll->begin(); lit != ll->end(); lit++ ) {
-	delete [] *lit;
+      // Zero fill broadcast by this node: the bytes of its block beyond the longest segment XORed into it
+      for( unsigned int j = 0; j < numSender; j++ ) {
+	if( (unsigned int) planPacket[ first + j ].sender != rank ) {
+	  continue;
+	}
+	unsigned long long maxSeg = 0;
+	for( unsigned int d = 0; d < numSender; d++ ) {
+	  maxSeg = d == j ? maxSeg : max( maxSeg, segSize[ segId( j, d ) ] );
+	}
+	padSize += blockSize[ ( first + j ) * eta + e ] - maxSeg;
       }
-      delete ll;
     }
+  }
+}
 
-    // Initialize encode data
-    encodeDataSend[ nsid ].data = new unsigned char[ maxSize * lineSize ](); // Initial it with 0
-    encodeDataSend[ nsid ].size = maxSize;
-    unsigned char* data = encodeDataSend[ nsid ].data;
 
-    // Encode Data
-    for( auto qit = nsit->begin(); qit != nsit->end(); qit++ ) {
-      if( (unsigned int) *qit == rank ) {
-	continue;
-      }
-      int destId = *qit;      
-      NodeSet inputIdx( *nsit );
-      inputIdx.erase( destId );
-      unsigned long fid = cg->getFileIDFromNodeSet( inputIdx );
-      VpairList vplist;
-      vplist.push_back( Vpair( destId, fid ) );
-
-      // Determine associated chunk of a worker ( order in ns )
-      unsigned int rankChunk = 0;  // in [ 0, ... , r - 1 ]
-      for( auto it = inputIdx.begin(); it != inputIdx.end(); it++ ) {
-	if( (unsigned int) *it == rank ) {
-	  break;
-	}
-	rankChunk++;
-      }
-      
-      // Start encoding
-      unsigned char* predata = encodePreData[ nsid ][ vplist ][ rankChunk ].data;
-      unsigned long long size = encodePreData[ nsid ][ vplist ][ rankChunk ].size;
-      unsigned long long maxiter = size * lineSize / sizeof( uint32_t );
-      for( unsigned long long i = 0; i < maxiter; i++ ) {
-	( ( uint32_t* ) data )[ i ] ^= ( ( uint32_t* ) predata )[ i ];
-      }
-
-      // Fill metadata
-      MetaData md;
-      md.vpList = vplist;
-      md.vpSize[ vplist[ 0 ] ] = size; // Assume Eta = 1;
-      md.partNumber = rankChunk + 1;
-      md.size = size; 
-      encodeDataSend[ nsid ].metaList.push_back( md );
-    }
-
-    // Serialize Metadata
-    EnData& endata = encodeDataSend[ nsid ];
-    unsigned int ms = 0;
-    ms += sizeof( unsigned int ); // metaList.size()
-    for ( unsigned int m = 0; m < endata.metaList.size(); m++ ) {
-      ms += sizeof( unsigned int ); // vpList.size()
-      ms += sizeof( int ) * 2 * endata.metaList[ m ].vpList.size(); // vpList
-      ms += sizeof( unsigned int ); // vpSize.size()
-      ms += ( sizeof( int ) * 2 + sizeof( unsigned long long ) ) * endata.metaList[ m ].vpSize.size(); // vpSize
-      ms += sizeof( unsigned int ); // partNumber
-      ms += sizeof( unsigned long long ); // size
-    }
-    encodeDataSend[ nsid ].metaSize = ms;
-
-    unsigned char* mbuff = new unsigned char[ ms ];
-    unsigned char* p = mbuff;
-    unsigned int metaSize = endata.metaList.size();
-    memcpy( p, &metaSize, sizeof( unsigned int ) );
-    p += sizeof( unsigned int );
-    // meta data List
-    for ( unsigned int m = 0; m < metaSize; m++ ) {
-      MetaData mdata = endata.metaList[ m ];
-      unsigned int numVp = mdata.vpList.size();
-      memcpy( p, &numVp, sizeof( unsigned int ) );
-      p += sizeof( unsigned int );
-      // vpair List
-      for ( unsigned int v = 0; v < numVp; v++ ) {
-	memcpy( p, &( mdata.vpList[ v ].first ), sizeof( int ) );
-	p += sizeof( int );
-	memcpy( p, &( mdata.vpList[ v ].second ), sizeof( int ) );
-	p += sizeof( int );
-      }
-      // vpair size Map
-      unsigned int numVps = mdata.vpSize.size();
-      memcpy( p, &numVps, sizeof( unsigned int ) );
-      p += sizeof( unsigned int );
-      for ( auto vpsit = mdata.vpSize.begin(); vpsit != mdata.vpSize.end(); vpsit++ ) {
-	Vpair vp = vpsit->first;
-	unsigned long long size = vpsit->second;
-	memcpy( p, &( vp.first ), sizeof( int ) );
-	p += sizeof( int );
-	memcpy( p, &( vp.second ), sizeof( int ) );
-	p += sizeof( int );
-	memcpy( p, &size, sizeof( unsigned long long ) );
-	p += sizeof( unsigned long long );
-      }
-      memcpy( p, &( mdata.partNumber ), sizeof( unsigned int ) );
-      p += sizeof( unsigned int );
-      memcpy( p, &( mdata.size ), sizeof( unsigned long long ) );
-      p += sizeof( unsigned long long );
-    }
-    encodeDataSend[ nsid ].serialMeta = mbuff;
+unsigned long long CodedWorker::getPacketSize( unsigned int pid )
+{
+  unsigned long long size = 0;
+  for( int e = 0; e < cg->getEta(); e++ ) {
+    size += blockSize[ pid * cg->getEta() + e ];
   }
+  return size;
 }
 
 
-void CodedWorker::execShuffle()
+void CodedWorker::execEncoding()
 {
-  // SUBSET-BY-SUBSET
-  // *** If it is to be used, need to fix ns to nsid.
-  // vector< NodeSet > subsetList = cg->getNodeSubsetS();
-  // for( auto nsit = subsetList.begin(); nsit != subsetList.end(); nsit++ ) {
-  //   NodeSet ns = *nsit;
-  //   MPI::Intracomm mcComm = multicastGroupMap[ ns ];
-  //   unsigned int rootId = 0;
-  //   for( auto nit = ns.begin(); nit != ns.end(); nit++ ) {
-  //     mcComm.Barrier();      
-  //     if( (unsigned int)( rank ) == (unsigned int)( *nit ) ) {
-  // 	// Active Node
-  // 	sendEncodeData( encodeDataSend[ ns ], mcComm );	
-  //     }
-  //     else {
-  // 	if( ns.find( rank ) != ns.end() ) {
-  // 	  // Receive Node
-  // 	  recvEncodeData( ns, rootId, mcComm );
-  // 	}
-  // 	else {
-  // 	  // Do nothing
-  // 	}
-
-  //     }
-  //     rootId++;
-  //     mcComm.Barrier();
-  //   }
-  // }
-
-
-  // NODE-BY-NODE
-  clock_t time;
-  //map< NodeSet, SubsetSId > ssmap = cg->getSubsetSIdMap();
-  for ( unsigned int activeId = 1; activeId <= conf->getNumReducer(); activeId++ ) {
-    unsigned long long tolSize;
-    clock_t txTime;
-    MPI_Barrier(workerComm);
-    if ( rank == activeId ) {
-      time = clock();
-      txTime = 0;
-      tolSize = 0;
-    }
-    vector< NodeSet >& vset = cg->getNodeSubsetSContain( activeId );
-    //for( auto nsit = ssmap.begin(); nsit != ssmap.end(); nsit++ ) {
-    for( auto nsit = vset.begin(); nsit != vset.end(); nsit++ ) {
-      // NodeSet ns = nsit->first;
-      // SubsetSId nsid = nsit->second;
-      NodeSet ns = *nsit;
-      SubsetSId nsid = cg->getSubsetSId( ns );
-
-      // Ignore subset that does not contain the activeId
-      if ( ns.find( activeId ) == ns.end() ) {
-  	continue;
-      }
-
-      MPI_Comm mcComm = multicastGroupMap[ nsid ];
-      if ( rank == activeId ) {
-	txTime -= clock();
-  	sendEncodeData( encodeDataSend[ nsid ], mcComm );
-	txTime += clock();
-	EnData& endata = encodeDataSend[ nsid ];
-	tolSize += ( endata.size * conf->getLineSize() ) + endata.metaSize + ( 2 * sizeof(unsigned long long ) );
-      }
-      else if ( ns.find( rank ) != ns.end() ) {
-  	//convert activeId to rootId of a particular multicast group
-  	unsigned int rootId = 0;
-  	for( auto nid = ns.begin(); nid != ns.end(); nid++ ) {
-  	  if( (unsigned int)(*nid) == activeId ) {
-  	    break;
-  	  }
-  	  rootId++;	  
-  	}
-  	recvEncodeData( nsid, rootId, mcComm );
-      }
-    }
-
-    // Active node should stop timer here
-    workerComm.Barrier();        
-    MPI_Barrier(workerComm);
-    if (rank == activeId) {
-      time = clock() - time;
-      double rTime = double(time) / CLOCKS_PER_SEC;
-      double txRate = (tolSize * 8 * 1e-6) / (double(txTime) / CLOCKS_PER_SEC);
-      MPI_Send(&rTime, 1, MPI_DOUBLE, 0, 0, MPI_COMM_WORLD);
-      MPI_Send(&txRate, 1, MPI_DOUBLE, 0, 0, MPI_COMM_WORLD);
-      //cout << rank  << ": Avg sending rate is " << ( tolSize * 8 ) / ( rtxTime * 1e6 ) << " Mbps, Data size is " << tolSize / 1e6 << " MByte\n";
+  vector< PlanPacket >& planPacket = cg->getPlanPacket();
+  vector< PlanSegment >& planSegment = cg->getPlanSegment();
+  unsigned int numSeg = cg->getNumSegment();
+  unsigned int numDest = conf->getLoad();
+  unsigned long long headerSize = getHeaderSize();
+
+  // Locate the bytes of every segment this node holds, in place in the partitions
+  balanceSegment();
+  planChunk.assign( planSegment.size(), NULL );
+  for( unsigned int i = 0; i < planSegment.size(); i++ ) {
+    PlanSegment& seg = planSegment[ i ];
+    if( (unsigned int) seg.dest != rank ) {
+      planChunk[ i ] = inputPartitionCollection[ seg.fid ][ seg.dest - 1 ].data + segOffset[ i ];
+    }
+  }
+
+  packetList.resize( planPacket.size() );
+  for( unsigned int pid = 0; pid < planPacket.size(); pid++ ) {
+    if( (unsigned int) planPacket[ pid ].sender != rank ) {
+      continue;
+    }
+    unsigned long long packetSize = getPacketSize( pid );
+
+    // Initialize encode data ( zeroed by the encoding tasks )
+    EnData& endata = packetList[ pid ];
+    endata.packet = allocBuffer( headerSize + packetSize );
+    endata.data = endata.packet + headerSize;
+    endata.size = packetSize;
+    unsigned long long* header = ( unsigned long long* ) endata.packet;
+
+    unsigned char* blockData = endata.data;
+    for( int e = 0; e < cg->getEta(); e++ ) {
+      // Collect chunks to be encoded into this sub-block
+      EncodeJob job;
+      job.data = blockData;
+      for( unsigned int d = 0; d < numDest; d++ ) {
+	unsigned int s = pid * numSeg + e * numDest + d;
+	job.src.push_back( planChunk[ s ] );
+	job.srcSize.push_back( segSize[ s ] );
+	header[ e * numDest + d ] = segSize[ s ];
+      }
+
+      // Large encoded chunks are cut into several tasks so that idle threads can share them
+      unsigned long long totalByte = blockSize[ pid * cg->getEta() + e ];
+      for( unsigned long long begin = 0; begin < totalByte; begin += ENCODE_BLOCK_SIZE ) {
+	EncodeTask task;
+	task.job = encodeJobList.size();
+	task.begin = begin;
+	task.end = min( totalByte, begin + ENCODE_BLOCK_SIZE );
+	encodeTaskList.push_back( task );
+      }
+      encodeJobList.push_back( job );
+      blockData += totalByte;
+    }
+  }
+
+  // Start encoding
+  ThreadPool pool( conf->getNumEncodeThread() );
+  pool.run( encodeTaskList.size(), execEncodeTask, ( void* ) this );
+  encodeTaskList.clear();
+  encodeJobList.clear();
+
+  // Partitions of other nodes are now only needed to decode received packets.
+  // Count their uses, those without any are freed at once.
+  unsigned int numReducer = conf->getNumReducer();
+  sideChunk.assign( conf->getNumInput() * numReducer, NULL );
+  sideChunkUse = new atomic< unsigned int >[ sideChunk.size() ];
+  for( unsigned int key = 0; key < sideChunk.size(); key++ ) {
+    sideChunkUse[ key ] = 0;
+  }
+  for( auto init = inputPartitionCollection.begin(); init != inputPartitionCollection.end(); init++ ) {
+    for( auto pit = init->second.begin(); pit != init->second.end(); pit++ ) {
+      if( pit->first != rank - 1 ) {
+	sideChunk[ ( init->first - 1 ) * numReducer + pit->first ] = &pit->second;
       }
+    }
+  }
+  for( unsigned int i = 0; i < planSegment.size(); i++ ) {
+    PlanSegment& seg = planSegment[ i ];
+    if( (unsigned int) planPacket[ i / numSeg ].sender != rank && (unsigned int) seg.dest != rank ) {
+      sideChunkUse[ ( seg.fid - 1 ) * numReducer + seg.dest - 1 ]++;
+    }
+  }
+  for( unsigned int key = 0; key < sideChunk.size(); key++ ) {
+    if( sideChunk[ key ] != NULL && sideChunkUse[ key ] == 0 ) {
+      freeBuffer( sideChunk[ key ]->data );
+      sideChunk[ key ]->data = NULL;
+    }
   }
 }
 
 
-void CodedWorker::execDecoding()
+void CodedWorker::execEncodeTask( unsigned long taskId, void* pthis )
 {
-  for( auto nsit = encodeDataRecv.begin(); nsit != encodeDataRecv.end(); nsit++ ) {
-    SubsetSId nsid = nsit->first;
-    vector< EnData >& endataList = nsit->second;
-    for( auto eit = endataList.begin(); eit != endataList.end(); eit++ ) {
-      EnData& endata = *eit;
-      unsigned char* cdData = endata.data;
-      unsigned long long cdSize = endata.size;
-      vector< MetaData >& metaList = endata.metaList;
-
-      unsigned int numDecode = 0;
-      // Decode per VpairList
-      MetaData dcMeta;
-      for( auto mit = metaList.begin(); mit != metaList.end(); mit++ ) {
-	MetaData& meta = *mit;
-	if( encodePreData[ nsid ].find( meta.vpList ) == encodePreData[ nsid ].end() ) {
- 	  dcMeta = meta;
-	  // No original data for decoding;
-	  continue;
-	}
-	unsigned char* oData = encodePreData[ nsid ][ meta.vpList ][ meta.partNumber - 1 ].data;
-	unsigned long long oSize = encodePreData[ nsid ][ meta.vpList ][ meta.partNumber - 1 ].size;
-	unsigned long long maxByte = min( oSize, cdSize ) * conf->getLineSize();
-	unsigned long long maxIter = maxByte / sizeof( uint32_t );
-	for( unsigned long long i = 0; i < maxIter; i++ ) {
-	  ((uint32_t*) cdData )[ i ] ^= ((uint32_t*) oData )[ i ];
-	}
-	numDecode++;
+  CodedWorker* parent = ( CodedWorker* ) pthis;
+  EncodeTask& task = parent->encodeTaskList[ taskId ];
+  EncodeJob& job = parent->encodeJobList[ task.job ];
+  unsigned int numSrc = job.src.size();
+
+  // All chunks of the range in one pass
+  const unsigned char* src[ numSrc ];
+  unsigned long long size[ numSrc ];
+  for( unsigned int i = 0; i < numSrc; i++ ) {
+    src[ i ] = job.src[ i ] + task.begin;
+    unsigned long long srcEnd = min( job.srcSize[ i ], task.end );
+    size[ i ] = srcEnd > task.begin ? srcEnd - task.begin : 0;
+  }
+  memset( job.data + task.begin, 0, task.end - task.begin );
+  xorMultiVar( job.data + task.begin, src, size, numSrc );
+}
+
+
+void CodedWorker::execShuffle()
+{
+  // ROUND-BY-ROUND
+  // All multicasts of a round have distinct senders and subsets, so they are issued together
+  MulticastScheduler scheduler( cg );
+  vector< MulticastRound >& rounds = scheduler.getRounds();
+  unsigned long long headerSize = getHeaderSize();
+  unsigned long long tolSize = 0;
+
+  MPI_Barrier(workerComm);
+  double time = MPI_Wtime();
+  for ( auto rit = rounds.begin(); rit != rounds.end(); rit++ ) {
+    // Multicasts of this round involving this node, as plan packets
+    vector< Multicast > active;
+    vector< unsigned int > activePid;
+    for ( auto mit = rit->begin(); mit != rit->end(); mit++ ) {
+      int pid = cg->getPlanPacketId( mit->sid, mit->rootId );
+      if ( pid >= 0 ) {
+	active.push_back( *mit );
+	activePid.push_back( pid );
       }
+    }
+    if ( active.empty() ) {
+      continue;
+    }
+
+    // Groups are created on first use, before any broadcast of the round is posted
+    unsigned int numActive = active.size();
+    vector< MPI_Comm > commList( numActive );
+    for ( unsigned int i = 0; i < numActive; i++ ) {
+      commList[ i ] = getMulticastGroup( active[ i ].sid );
+    }
 
-      // sanity check
-      if( numDecode != metaList.size() - 1 ) {
-	cout << rank << ": Decode error " << numDecode << '/' << metaList.size() - 1 << endl;
-	assert( numDecode != metaList.size() - 1 );
+    // One broadcast per packet, receivers know its size from the partition size table
+    vector< MPI_Request > reqList( numActive, MPI_REQUEST_NULL );
+    for ( unsigned int i = 0; i < numActive; i++ ) {
+      Multicast& mc = active[ i ];
+      MPI_Comm mcComm = commList[ i ];
+      EnData& endata = packetList[ activePid[ i ] ];
+      if ( (unsigned int) mc.sender != rank ) {
+	endata.size = getPacketSize( activePid[ i ] );
+	endata.packet = allocBuffer( headerSize + endata.size );
+	endata.data = endata.packet + headerSize;
+      }
+      else {
+	tolSize += headerSize + endata.size;
       }
+      MPI_Ibcast( endata.packet, headerSize + endata.size, MPI_UNSIGNED_CHAR, mc.rootId, mcComm, &reqList[ i ] );
+    }
+    MPI_Waitall( reqList.size(), &reqList[ 0 ], MPI_STATUSES_IGNORE );
 
-      if( decodePreData[ nsid ][ dcMeta.vpList ].empty() ) {
-      	for( unsigned int i = 0; i < conf->getLoad(); i++ ) {
-      	  decodePreData[ nsid ][ dcMeta.vpList ].push_back( DataChunk() );
-      	}
+    for ( unsigned int i = 0; i < numActive; i++ ) {
+      if ( (unsigned int) active[ i ].sender == rank ) {
+	freeBuffer( packetList[ activePid[ i ] ].packet );
+      }
+      else {
+	storeEncodeData( activePid[ i ] );
       }
+    }
+  }
+  MPI_Barrier(workerComm);
+
+  double rTime = MPI_Wtime() - time;
+  double txRate = (tolSize * 8 * 1e-6) / rTime;
+  MPI_Send(&rTime, 1, MPI_DOUBLE, 0, 0, MPI_COMM_WORLD);
+  MPI_Send(&txRate, 1, MPI_DOUBLE, 0, 0, MPI_COMM_WORLD);
+  double shuffleByte[ 2 ] = { double( tolSize ), padSize };
+  MPI_Send(shuffleByte, 2, MPI_DOUBLE, 0, 0, MPI_COMM_WORLD);
+}
+
+
+void CodedWorker::execDecoding()
+{
+  vector< PlanPacket >& planPacket = cg->getPlanPacket();
+  vector< PlanSegment >& planSegment = cg->getPlanSegment();
 
-      decodePreData[ nsid ][ dcMeta.vpList ][ dcMeta.partNumber - 1].data = cdData;
-      decodePreData[ nsid ][ dcMeta.vpList ][ dcMeta.partNumber - 1].size = dcMeta.size;
+  if( !decodeThread.empty() ) {
+    // Most packets are already decoded, wait for the rest
+    joinParallelDecoder();
+  }
+  else {
+    for( unsigned int pid = 0; pid < planPacket.size(); pid++ ) {
+      if( (unsigned int) planPacket[ pid ].sender != rank ) {
+	decodeData( pid, packetList[ pid ] );
+      }
     }
   }
 
@@ -528,42 +614,62 @@ void CodedWorker::execDecoding()
   unsigned int partitionId = rank - 1;
   unsigned int lineSize = conf->getLineSize();  
 
-  // Get partitioned data from input files, already stored in memory.
-  InputSet inputSet = cg->getM( rank );
-  for( auto init = inputSet.begin(); init != inputSet.end(); init++ ) {
-    unsigned int inputId = *init;
-    LineList* ll = inputPartitionCollection[ inputId ][ partitionId ];
-    // copy line by line
-    for( auto lit = ll->begin(); lit != ll->end(); lit++ ) {
-      unsigned char* buff = new unsigned char[ lineSize ];
-      memcpy( buff, *lit, lineSize );
-      localList.push_back( buff );
-    }
-    localLoadSet.insert( inputId );
-  }
-
-  // Get partitioned data from other workers
-  for( auto nvit = decodePreData.begin(); nvit != decodePreData.end(); nvit++ ) {
-    DataPartMap& dpMap = nvit->second;
-    for( auto vvit = dpMap.begin(); vvit != dpMap.end(); vvit++ ) {
-      VpairList vplist = vvit->first;
-      vector< DataChunk > vdc = vvit->second;
-      // Add inputId to localLoadSet
-      for( auto vpit = vplist.begin(); vpit != vplist.end(); vpit++ ) {
-  	localLoadSet.insert( vpit->second );
-      }
-      // Add data from each part to locallist
-      for( auto dcit = vdc.begin(); dcit != vdc.end(); dcit++ ) {
-  	unsigned char* data = dcit->data;
-  	for( unsigned long long i = 0; i < dcit->size; i++ ) {
-  	  unsigned char* buff = new unsigned char[ lineSize ];
-  	  memcpy( buff, data + i*lineSize, lineSize );
-  	  localList.push_back( buff );	  	  
-  	}
-  	delete [] dcit->data;
+  if( localArena != NULL ) {
+    // Received segments were decoded into partitionSlice, own partitions are already in localList
+    InputSet inputSet = cg->getM( rank );
+    for( auto init = inputSet.begin(); init != inputSet.end(); init++ ) {
+      localLoadSet.insert( *init );
+    }
+    for( unsigned int i = 0; i < planSegment.size(); i++ ) {
+      if( (unsigned int) planSegment[ i ].dest == rank ) {
+	localLoadSet.insert( planSegment[ i ].fid );
       }
     }
   }
+  else {
+    // Get partitioned data from input files, already stored in memory.
+    InputSet inputSet = cg->getM( rank );
+    for( auto init = inputSet.begin(); init != inputSet.end(); init++ ) {
+      unsigned int inputId = *init;
+      DataChunk& partition = inputPartitionCollection[ inputId ][ partitionId ];
+      // copy line by line
+      for( unsigned long long i = 0; i < partition.size; i++ ) {
+	addLocalLine( partition.data + i * lineSize );
+      }
+      localLoadSet.insert( inputId );
+    }
+
+    // Get partitioned data from other workers, segments may cut lines so each partition is put back together first
+    vector< unsigned char* > recvPartition( conf->getNumInput(), NULL );  // key = fid - 1
+    for( unsigned int i = 0; i < planSegment.size(); i++ ) {
+      PlanSegment& seg = planSegment[ i ];
+      if( (unsigned int) seg.dest != rank ) {
+	continue;
+      }
+      unsigned char*& buff = recvPartition[ seg.fid - 1 ];
+      if( buff == NULL ) {
+	buff = allocBuffer( partitionSize[ ( seg.fid - 1 ) * conf->getNumReducer() + partitionId ] * lineSize );
+      }
+      memcpy( buff + segOffset[ i ], planChunk[ i ], segSize[ i ] );
+    }
+    for( unsigned long fid = 1; fid <= recvPartition.size(); fid++ ) {
+      unsigned char* buff = recvPartition[ fid - 1 ];
+      if( buff == NULL ) {
+	continue;
+      }
+      localLoadSet.insert( fid );
+      unsigned long long numLine = partitionSize[ ( fid - 1 ) * conf->getNumReducer() + partitionId ];
+      for( unsigned long long l = 0; l < numLine; l++ ) {
+	addLocalLine( buff + l * lineSize );
+      }
+      freeBuffer( buff );
+    }
+  }
+  for( unsigned int pid = 0; pid < planPacket.size(); pid++ ) {
+    if( (unsigned int) planPacket[ pid ].sender != rank ) {
+      freeBuffer( packetList[ pid ].packet );
+    }
+  }
   
   if( localLoadSet.size() != conf->getNumInput() ) {
     cout << rank << ": Only have paritioned data from ";
@@ -574,193 +680,265 @@ void CodedWorker::execDecoding()
 }
 
 
-// PARALLEL DECODE THREAD FUNCTION
-// void* CodedWorker::parallelDecoder( void* pthis )
-// {
-//   CodedWorker* parent = ( CodedWorker* ) pthis;
-  
-//   unsigned long maxNumJob = parent->maxDecodeJob;
-//   while( maxNumJob > 0 ) {
-//     // decode from queue
-//     if( parent->decodeQueue.empty() ) {
-//       continue;
-//     }
-    
-//     DecodeJob job = parent->decodeQueue.front();
-//     parent->decodeQueue.pop();
-//     SubsetSId& nsid = job.sid;
-//     EnData& endata = job.endata;
-//     LineList* cdData = endata.data;
-//     vector< MetaData >& metaList = endata.metaList;
-
-//     unsigned int numDecode = 0;
-//     // Decode per VpairList
-//     MetaData dcMeta;
-//     for( auto mit = metaList.begin(); mit != metaList.end(); mit++ ) {
-//       MetaData& meta = *mit;
-//       if( parent->encodePreData[ nsid ].find( meta.vpList ) == parent->encodePreData[ nsid ].end() ) {
-// 	dcMeta = meta;
-// 	// No original data for decoding;
-// 	continue;
-//       }
-//       LineList* oData = parent->encodePreData[ nsid ][ meta.vpList ][ meta.partNumber - 1 ];
-//       auto cdlit = cdData->begin();
-//       auto olit = oData->begin();
-//       while( cdlit != cdData->end() && olit != oData->end() ) {
-// 	// 4-Byte by 4-Byte decoding
-// 	// This assumes that line size is divisible by 4
-// 	unsigned int maxIter = parent->conf->getLineSize() / sizeof( uint32_t );
-// 	for( unsigned int i = 0; i < maxIter; i++ ) {
-// 	  ((uint32_t*) *cdlit)[ i ] ^= ((uint32_t*) *olit)[ i ];
-// 	}
-
-	
-// 	cdlit++;
-// 	olit++;
-//       }
-//       numDecode++;
-//     }
-
-//     // sanity check
-//     if( numDecode != metaList.size() - 1 ) {
-//       cout << parent->rank << ": Decode error " << numDecode << '/' << metaList.size() - 1 << endl;
-//       assert( numDecode != metaList.size() - 1 );
-//     }
-
-//     // Trim decoded data back to its original data size
-//     while( cdData->size() > dcMeta.size ) {
-//       cdData->pop_back();
-//     }
-      
-//     if( parent->decodePreData[ nsid ][ dcMeta.vpList ].empty() ) {
-//       for( unsigned int i = 0; i < parent->conf->getLoad(); i++ ) {
-// 	parent->decodePreData[ nsid ][ dcMeta.vpList ].push_back( NULL );
-//       }
-//     }
-
-//     parent->decodePreData[ nsid ][ dcMeta.vpList ][ dcMeta.partNumber - 1] = cdData;    
-//     maxNumJob--;
-//     cout << parent->rank << ": maxNumjob " << maxNumJob << endl;
-//   }
-
-//   return NULL;
-// }
-
-
-void CodedWorker::execReduce()
-{  
-  // if( rank == 1) {
-  //   cout << rank << ":Sort " << localList.size() << " lines\n";
-  // }
-  // stable_sort( localList.begin(), localList.end(), Sorter( conf->getKeySize() ) );
-  sort( localList.begin(), localList.end(), Sorter( conf->getKeySize() ) );
+void CodedWorker::decodeData( unsigned int pid, EnData& endata )
+{
+  const unsigned long long* header = ( const unsigned long long* ) endata.packet;
+  unsigned int numSeg = cg->getNumSegment();
+  unsigned int numDest = conf->getLoad();
+  // Read only here, shared by decoder threads
+  PlanSegment* seg = &cg->getPlanSegment()[ pid * numSeg ];
+
+  // Decode sub-block by sub-block
+  unsigned char* cdData = endata.data;
+  for( int e = 0; e < cg->getEta(); e++ ) {
+    unsigned int numDecode = 0;
+    const unsigned char* dcSrc[ numDest ];
+    unsigned long long dcSize[ numDest ];
+    unsigned int own = 0;
+    for( unsigned int d = 0; d < numDest; d++ ) {
+      unsigned int s = e * numDest + d;
+      unsigned int i = pid * numSeg + s;
+      if( segSize[ i ] != header[ s ] ) {
+	cout << rank << ": Decode error, segment of " << header[ s ] << " bytes instead of " << segSize[ i ] << endl;
+	assert( false );
+      }
+      if( (unsigned int) seg[ s ].dest == rank ) {
+	// No original data for decoding;
+	own = i;
+	continue;
+      }
+      dcSrc[ numDecode ] = planChunk[ i ];
+      dcSize[ numDecode ] = segSize[ i ];
+      numDecode++;
+    }
+    if( !partitionSlice.empty() ) {
+      // Straight to its place in the partition, the packet is only read
+      planChunk[ own ] = partitionSlice[ seg[ own - pid * numSeg ].fid - 1 ] + segOffset[ own ];
+      xorMultiVarTo( planChunk[ own ], cdData, segSize[ own ], dcSrc, dcSize, numDecode );
+    }
+    else {
+      planChunk[ own ] = cdData;
+      xorMultiVar( cdData, dcSrc, dcSize, numDecode );
+    }
+    for( unsigned int d = 0; d < numDest; d++ ) {
+      PlanSegment& s = seg[ e * numDest + d ];
+      if( (unsigned int) s.dest != rank ) {
+	releaseSideChunk( ( s.fid - 1 ) * conf->getNumReducer() + s.dest - 1 );
+      }
+    }
+    cdData += blockSize[ pid * cg->getEta() + e ];
+  }
+
+  // Nothing points into the packet once it was decoded into the partition
+  if( !partitionSlice.empty() ) {
+    freeBuffer( endata.packet );
+    packetList[ pid ].packet = NULL;
+  }
+}
+
+
+void CodedWorker::releaseSideChunk( unsigned int key )
+{
+  // Decoder threads may release the same partition, the last one frees it
+  if( --sideChunkUse[ key ] == 0 ) {
+    freeBuffer( sideChunk[ key ]->data );
+    sideChunk[ key ]->data = NULL;
+  }
+}
+
+
+// Peak and current resident memory in kB from /proc/self/status
+static bool readResidentMemory( unsigned long& peak, unsigned long& current )
+{
+  FILE* f = fopen( "/proc/self/status", "r" );
+  if( f == NULL ) {
+    return false;
+  }
+  char line[ 256 ];
+  unsigned long kb;
+  int found = 0;
+  while( fgets( line, sizeof( line ), f ) != NULL ) {
+    if( sscanf( line, "VmHWM: %lu kB", &kb ) == 1 ) {
+      peak = kb;
+      found++;
+    }
+    else if( sscanf( line, "VmRSS: %lu kB", &kb ) == 1 ) {
+      current = kb;
+      found++;
+    }
+  }
+  fclose( f );
+  return found == 2;
 }
 
 
+void CodedWorker::restartPhaseMemory()
+{
+  // Writing 5 to clear_refs resets VmHWM to the current resident size ( Linux 4.0 and later ).
+  // Without it the peak of a phase includes the earlier phases, so the reset is checked.
+  if( !conf->getReportMemory() || !phaseMemoryValid ) {
+    return;
+  }
+  unsigned long peak = 0;
+  unsigned long current = 0;
+  unsigned long before = 0;
+  bool reset = readResidentMemory( before, current );
+  FILE* f = fopen( "/proc/self/clear_refs", "w" );
+  if( f == NULL ) {
+    reset = false;
+  }
+  else {
+    reset = fputs( "5", f ) != EOF && reset;
+    reset = fclose( f ) == 0 && reset;
+  }
+  // Done if the peak dropped, or if it was already the current size
+  reset = reset && readResidentMemory( peak, current ) && ( peak < before || peak <= current );
+  if( !reset ) {
+    phaseMemoryValid = false;
+    if( rank == 1 ) {
+      cout << rank << ": Cannot reset the peak resident memory ( /proc/self/clear_refs ), the peak of each phase is not available\n";
+    }
+  }
+}
+
 
-void CodedWorker::sendEncodeData(CodedWorker::EnData& endata, MPI_Comm& comm)
+void CodedWorker::markPhaseMemory()
 {
-  // Send actual data
-  unsigned lineSize = conf->getLineSize();
-  int rootId;
-  MPI_Comm_rank(comm, &rootId);
-  MPI_Bcast(&(endata.size), 1, MPI_UNSIGNED_LONG_LONG, rootId, comm);
-  MPI_Bcast(endata.data, endata.size * lineSize, MPI_UNSIGNED_CHAR, rootId, comm);
-  delete[] endata.data;
-
-  // Send serialized meta data
-  MPI_Bcast(&(endata.metaSize), 1, MPI_UNSIGNED_LONG_LONG, rootId, comm);
-  MPI_Bcast(endata.serialMeta, endata.metaSize, MPI_UNSIGNED_CHAR, rootId, comm);
-  delete[] endata.serialMeta;
+  if( !conf->getReportMemory() ) {
+    return;
+  }
+  unsigned long peak = 0;
+  unsigned long current = 0;
+  if( !readResidentMemory( peak, current ) ) {
+    phaseMemoryValid = false;
+  }
+  phaseMemory.push_back( peak / 1024.0 );
+  restartPhaseMemory();
 }
 
 
-void CodedWorker::recvEncodeData( SubsetSId nsid, unsigned int rootId,MPI_Comm& comm )
+void CodedWorker::startParallelDecoder()
 {
-  EnData endata;
-  unsigned lineSize = conf->getLineSize();
-
-  // Receive actual data
-  MPI_Bcast(&(endata.size), 1, MPI_UNSIGNED_LONG_LONG, rootId, comm);
-  endata.data = new unsigned char[endata.size * lineSize];
-  MPI_Bcast(endata.data, endata.size * lineSize, MPI_UNSIGNED_CHAR, rootId, comm);
-  MPI_Bcast( endata.data, endata.size*lineSize, MPI_UNSIGNED_CHAR, rootId );
-
-  // Receive serialized meta data
-  MPI_Bcast(&(endata.metaSize), 1, MPI_UNSIGNED_LONG_LONG, rootId, comm);
-  endata.serialMeta = new unsigned char[endata.metaSize];
-  MPI_Bcast((unsigned char*)endata.serialMeta, endata.metaSize, MPI_UNSIGNED_CHAR, rootId, comm);
-
-  // De-serialized meta data
-  unsigned char* p = endata.serialMeta;
-  unsigned int metaNum;
-  memcpy( &metaNum, p, sizeof( unsigned int ) );
-  p += sizeof( unsigned int );
-  // meta data List  
-  for ( unsigned int m = 0; m < metaNum; m++ ) {
-    MetaData mdata;
-    // vpair List
-    unsigned int numVp;
-    memcpy( &numVp, p, sizeof( unsigned int ) );
-    p += sizeof( unsigned int );
-    for ( unsigned int v = 0; v < numVp; v++ ) {
-      Vpair vp;
-      memcpy( &( vp.first ), p, sizeof( int ) );
-      p += sizeof( int );
-      memcpy( &( vp.second ), p, sizeof( int ) );
-      p += sizeof( int );
-      mdata.vpList.push_back( vp );
-    }
-    // VpairSize Map
-    unsigned int numVps;
-    memcpy( &numVps, p, sizeof( unsigned int ) );
-    p += sizeof( unsigned int );
-    for ( unsigned int vs = 0; vs < numVps; vs++ ) {
-      Vpair vp;
-      unsigned long long size;
-      memcpy( &( vp.first ), p, sizeof( int ) );
-      p += sizeof( int );
-      memcpy( &( vp.second ), p, sizeof( int ) );
-      p += sizeof( int );
-      memcpy( &size, p, sizeof( unsigned long long ) );
-      p += sizeof( unsigned long long );
-      mdata.vpSize[ vp ] = size;
-    }
-    memcpy( &( mdata.partNumber ), p, sizeof( unsigned int ) );
-    p += sizeof( unsigned int );
-    memcpy( &( mdata.size ), p, sizeof( unsigned long long ) );
-    p += sizeof( unsigned long long );
-    endata.metaList.push_back( mdata );
-  }
-  delete [] endata.serialMeta;
-
-  //Serial decoder
-  encodeDataRecv[ nsid ].push_back( endata );
+  unsigned int numThread = conf->getNumDecodeThread();
+
+  // A queue can hold every packet this node receives, so the shuffle never waits for a decoder
+  unsigned long maxDecodeJob = cg->getPlanPacket().size() + 1;
+
+  decodeThread.resize( numThread );
+  decoderArg.resize( numThread );
+  for( unsigned int t = 0; t < numThread; t++ ) {
+    decodeQueue.push_back( new SpscQueue< DecodeJob >( maxDecodeJob ) );
+  }
+  for( unsigned int t = 0; t < numThread; t++ ) {
+    decoderArg[ t ].parent = this;
+    decoderArg[ t ].tid = t;
+    if( pthread_create( &decodeThread[ t ], NULL, parallelDecoder, ( void* ) &decoderArg[ t ] ) ) {
+      cout << rank << ": ERROR -- cannot create parallel decoder thread\n";
+      assert( false );
+    }
+  }
 }
 
 
-void CodedWorker::genMulticastGroup()
+void CodedWorker::joinParallelDecoder()
 {
-map< NodeSet, SubsetSId > ssmap = cg->getSubsetSIdMap();
-for( auto nsit = ssmap.begin(); nsit != ssmap.end(); nsit++ ) {
-NodeSet ns = nsit->first;
-SubsetSId nsid = nsit->second;
-int color = ( ns.find( rank ) != ns.end() ) ? 1 : 0;
-MPI_Comm mgComm;
-MPI_Comm_split(workerComm, color, rank, &mgComm);
-multicastGroupMap[nsid] = mgComm;
+  // Tell every decoder there is no more job
+  DecodeJob last;
+  last.endata.data = NULL;
+  for( unsigned int t = 0; t < decodeThread.size(); t++ ) {
+    while( !decodeQueue[ t ]->push( last ) ) {
+      sched_yield();
+    }
+  }
+  for( unsigned int t = 0; t < decodeThread.size(); t++ ) {
+    pthread_join( decodeThread[ t ], NULL );
+    delete decodeQueue[ t ];
+  }
+  decodeThread.clear();
+  decodeQueue.clear();
 }
+
+
+// PARALLEL DECODE THREAD FUNCTION
+void* CodedWorker::parallelDecoder( void* parg )
+{
+  DecoderArg* arg = ( DecoderArg* ) parg;
+  CodedWorker* parent = arg->parent;
+  SpscQueue< DecodeJob >* queue = parent->decodeQueue[ arg->tid ];
+
+  DecodeJob job;
+  unsigned int idle = 0;
+  while( true ) {
+    if( !queue->pop( job ) ) {
+      // Back off so that the shuffling thread keeps its core
+      if( ++idle < 64 ) {
+	sched_yield();
+      }
+      else {
+	usleep( 50 );
+      }
+      continue;
+    }
+    idle = 0;
+    if( job.endata.data == NULL ) {
+      break;
+    }
+    parent->decodeData( job.pid, job.endata );
+  }
+
+  return NULL;
 }
 
 
-void CodedWorker::printLocalList()
+void CodedWorker::storeEncodeData( unsigned int pid )
 {
-  unsigned long int i = 0;
-  for ( auto it = localList.begin(); it != localList.end(); ++it ) {
-    cout << rank << ": " << i++ << "| ";
-    printKey( *it, conf->getKeySize() );
-    cout << endl;
+  if( !decodeThread.empty() ) {
+    // Parallel decoder, packets are assigned to decoder threads round-robin
+    DecodeJob job;
+    job.pid = pid;
+    job.endata = packetList[ pid ];
+    SpscQueue< DecodeJob >* queue = decodeQueue[ pid % decodeThread.size() ];
+    while( !queue->push( job ) ) {
+      sched_yield();
+    }
+  }
+  // Serial decoder finds the packet in packetList after the shuffle
+}
+
+
+MPI_Comm CodedWorker::getMulticastGroup( SubsetSId nsid )
+{
+  NodeMask mask = cg->getSubsetSMask( nsid );
+  auto git = multicastGroupMap.find( mask );
+  if( git != multicastGroupMap.end() ) {
+    return git->second;
+  }
+
+  // Only members take part, node i is rank i - 1 of workerComm.
+  // All nodes create groups in the same global order, so this cannot deadlock.
+  // The tag is the subset id, unique among all groups created on workerComm.
+  int* tagUB;
+  int flag;
+  MPI_Comm_get_attr( MPI_COMM_WORLD, MPI_TAG_UB, &tagUB, &flag );
+  if( !flag || nsid > ( SubsetSId ) *tagUB ) {
+    cout << "Subset id " << nsid << " exceeds the largest MPI tag\n";
+    assert( false );
   }
+  int members[ cg->getR() + 1 ];
+  int numMember = 0;
+  for( NodeMask m = mask; m != 0; m &= m - 1 ) {
+    members[ numMember++ ] = __builtin_ctzll( m );
+  }
+  MPI_Group workerGroup;
+  MPI_Group mgGroup;
+  MPI_Comm mgComm;
+  MPI_Comm_group( workerComm, &workerGroup );
+  MPI_Group_incl( workerGroup, numMember, members, &mgGroup );
+  MPI_Comm_create_group( workerComm, mgGroup, nsid, &mgComm );
+  MPI_Group_free( &mgGroup );
+  MPI_Group_free( &workerGroup );
+  multicastGroupMap[ mask ] = mgComm;
+  return mgComm;
 }
 
 
@@ -775,12 +953,10 @@ void CodedWorker::writeInputPartitionCollection()
     PartitionCollection& pc = inputPartitionCollection[ inputId ];
     for ( auto pit = pc.begin(); pit != pc.end(); pit++ ) {
       unsigned int parId = pit->first;
-      LineList* list = pit->second;
+      DataChunk& partition = pit->second;
       sprintf( buff, ">> Input %u, Partition %u <<", inputId, parId );
       outf.write( buff, strlen( buff ) );
-      for ( auto lit = list->begin(); lit != list->end(); lit++ ) {
-	outf.write( ( char * ) *lit, conf->getLineSize() );
-      }
+      outf.write( ( char * ) partition.data, partition.size * conf->getLineSize() );
     }
   }
   outf.close();
@@ -788,38 +964,3 @@ void CodedWorker::writeInputPartitionCollection()
 }
 
 
-void CodedWorker::outputLocalList()
-{
-  char buff[ MAX_FILE_PATH ];
-  sprintf( buff, "%s_%u", conf->getOutputPath(), rank - 1 );
-  ofstream outputFile( buff, ios::out | ios::binary | ios::trunc );
-  for ( auto it = localList.begin(); it != localList.end(); ++it ) {
-    outputFile.write( ( char* ) *it, conf->getLineSize() );
-  }
-  outputFile.close();
-  //cout << rank << ": outputFile " << buff << " is saved.\n";
-}
-
-
-TrieNode* CodedWorker::buildTrie( PartitionList* partitionList, int lower, int upper, unsigned char* prefix, int prefixSize, int maxDepth )
-{
-  if ( prefixSize >= maxDepth || lower == upper ) {
-    return new LeafTrieNode( prefixSize, partitionList, lower, upper );
-  }
-  InnerTrieNode* result = new InnerTrieNode( prefixSize );
-  int curr = lower;
-  for ( unsigned char ch = 0; ch < 255; ch++ ) {
-    prefix[ prefixSize ] = ch;
-    lower = curr;
-    while( curr < upper ) {
-      if( cmpKey( prefix, partitionList->at( curr ), prefixSize + 1 ) ) {
-	break;
-      }
-      curr++;
-    }
-    result->setChild( ch, buildTrie( partitionList, lower, curr, prefix, prefixSize + 1, maxDepth ) );
-  }
-  prefix[ prefixSize ] = 255;
-  result->setChild( 255, buildTrie( partitionList, curr, upper, prefix, prefixSize + 1, maxDepth ) );
-  return result;
-}
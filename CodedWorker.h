@@ -3,6 +3,7 @@
 
 #include <mpi.h>
 #include <unordered_map>
+#include <atomic>
 #include <pthread.h>
 
 #include "CodedConfiguration.h"
@@ -10,101 +11,118 @@
 #include "Common.h"
 #include "Utility.h"
 #include "Trie.h"
+#include "SpscQueue.h"
+#include "WorkerBase.h"
 
 using namespace std;
 
-class CodedWorker
+class CodedWorker : public WorkerBase
 {
  public:
-  typedef unordered_map< unsigned int, LineList* > PartitionCollection; // key = destID
+  typedef struct _DataChunk {
+    unsigned char* data;
+    unsigned long long size; // number of lines
+  } DataChunk;
+
+  typedef unordered_map< unsigned int, DataChunk > PartitionCollection; // key = destID, lines are contiguous
   typedef unordered_map< unsigned int, PartitionCollection > InputPartitionCollection;  // key = inputID
-  typedef unordered_map< SubsetSId, MPI::Intracomm > MulticastGroupMap;
+  typedef unordered_map< NodeMask, MPI_Comm > MulticastGroupMap;  // key = members of the group
 
   /* typedef map< unsigned int, LineList* > PartitionCollection; // key = destID */
   /* typedef map< unsigned int, PartitionCollection > InputPartitionCollection;  // key = inputID */
   /* typedef map< SubsetSId, MPI::Intracomm > MulticastGroupMap;   */
-  typedef map< Vpair, unsigned long long > VpairSizeMap;
 
-  typedef struct _DataChunk {
-    unsigned char* data;
-    unsigned long long size; // number of lines
-  } DataChunk;
-  typedef map< VpairList, vector< DataChunk > > DataPartMap;
-  typedef unordered_map< SubsetSId, DataPartMap > NodeSetDataPartMap;  // [Encode/Decode]PreData
-  /* typedef map< SubsetSId, DataPartMap > NodeSetDataPartMap;  // [Encode/Decode]PreData   */
-  
-  typedef struct _MetaData {
-    VpairList vpList;
-    VpairSizeMap vpSize;
-    unsigned int partNumber; // { 1, 2, ... }
-    unsigned long long size; // number of lines
-  } MetaData;
-  
+  // A coded packet is a fixed header followed by Eta encoded sub-blocks, one per file of a destination.
+  // The header holds r * Eta segment sizes ( in bytes ) in the order of the plan segments of the packet:
+  // by sub-block, then by destination. Everything else follows from the code plan.
   typedef struct _EnData {
-    vector< MetaData > metaList;
-    unsigned char* data;          // encoded chunk
-    unsigned long long size;      // in number of lines
-    unsigned char* serialMeta;
-    unsigned long long metaSize;  // in number of bytes
+    unsigned char* packet;        // header + encoded chunk, single allocation
+    unsigned char* data;          // encoded sub-blocks, points into packet
+    unsigned long long size;      // in number of bytes, all sub-blocks
   } EnData;
-  typedef unordered_map< SubsetSId, EnData > NodeSetEnDataMap;  // SendData
-  typedef unordered_map< SubsetSId, vector< EnData > > NodeSetVecEnDataMap;  // RecvData
-  /* typedef map< SubsetSId, EnData > NodeSetEnDataMap;  // SendData */
-  /* typedef map< SubsetSId, vector< EnData > > NodeSetVecEnDataMap;  // RecvData   */
-  
 
   typedef struct {
-    SubsetSId sid;
-    EnData endata;
+    unsigned int pid;  // plan packet
+    EnData endata;  // endata.data == NULL marks the end of the jobs
   } DecodeJob;
 
+  typedef struct {
+    CodedWorker* parent;
+    unsigned int tid;
+  } DecoderArg;
+
+  typedef struct {
+    unsigned char* data;                  // encoded chunk
+    vector< const unsigned char* > src;   // chunks XORed into data
+    vector< unsigned long long > srcSize; // in number of bytes
+  } EncodeJob;
+
+  typedef struct {
+    unsigned int job;          // index in encodeJobList
+    unsigned long long begin;  // byte range of the encoded chunk
+    unsigned long long end;
+  } EncodeTask;
+
   
  private:
-  MPI::Intracomm workerComm;
   CodeGeneration* cg;
 
-  PartitionList partitionList;
   InputPartitionCollection inputPartitionCollection;
-  LineList localList;
   NodeSet localLoadSet;
-  TrieNode* trie;
 
 
-  NodeSetEnDataMap encodeDataSend;
-  NodeSetVecEnDataMap encodeDataRecv;
   MulticastGroupMap multicastGroupMap;
-  pthread_t decodeThread;
+  vector< pthread_t > decodeThread;
+  vector< DecoderArg > decoderArg;
+  vector< EncodeJob > encodeJobList;
+  vector< EncodeTask > encodeTaskList;
+  vector< EnData > packetList;  // key = plan packet, sent or received
+  vector< unsigned long long > partitionSize;  // lines of partition ( fid, dest ) at ( fid - 1 ) * K + dest - 1, on all nodes
+  vector< DataChunk* > sideChunk;  // same key, partitions of other nodes kept for decoding, NULL if not held
+  atomic< unsigned int >* sideChunkUse;  // same key, segments of received packets still to be decoded with it
+  vector< double > phaseMemory;  // peak resident memory of each phase in MB, see CodedConfiguration::reportMemory
+  bool phaseMemoryValid;  // every restart reset the peak, otherwise phaseMemory is reported as -1
+  double padSize;  // bytes broadcast by this node that no segment of their packet covers
 
  public: // Because of thread
   const CodedConfiguration* conf;
-  unsigned int rank;  
-  NodeSetDataPartMap encodePreData;
-  NodeSetDataPartMap decodePreData;    
-  //queue< DecodeJob > decodeQueue;  // For parallel decode
-  unsigned long maxDecodeJob;  
+  vector< unsigned char* > planChunk;  // key = plan segment, in inputPartitionCollection, or where it was decoded for own destination
+  vector< unsigned char* > partitionSlice;  // key = fid - 1, partition ( fid, rank ) in localArena, empty with a memory budget
+  vector< unsigned long long > segOffset;  // key = plan segment, in bytes within partition ( fid, dest )
+  vector< unsigned long long > segSize;  // key = plan segment, in bytes
+  vector< unsigned long long > blockSize;  // key = plan packet * Eta + sub-block, in bytes
+  vector< SpscQueue< DecodeJob >* > decodeQueue;  // For parallel decode, one per decoder thread
 
  public:
- CodedWorker( unsigned int _rank ): rank( _rank ) {}
+ CodedWorker( unsigned int _rank, const CodedConfiguration& _conf ): WorkerBase( _rank ), sideChunkUse( NULL ), phaseMemoryValid( true ), conf( new CodedConfiguration( _conf ) ) {}
   ~CodedWorker();
-  void setWorkerComm( MPI_Comm& comm ) { workerComm = comm; }
   void run();
   
 
  private:
+  const Configuration* getConfiguration() const { return conf; }
   unsigned int findAssociatePartition( const unsigned char* key );
+  vector< unsigned int > getSampleInputs();
   void execMap();
-  void execReduce();
+  void exchangePartitionSize();
+  void newPartitionSlice();  // localArena for the partitions this node receives, so decoding writes into place
+  void balanceSegment();
+  unsigned long long getPacketSize( unsigned int pid );
+  unsigned long long getHeaderSize() { return cg->getNumSegment() * sizeof( unsigned long long ); }
   void execEncoding();
+  static void execEncodeTask( unsigned long taskId, void* pthis );
   void execShuffle();
   void execDecoding();
-  static void* parallelDecoder( void* pthis );
-  void sendEncodeData(EnData& endata, MPI_Comm& comm);
-  void recvEncodeData( SubsetSId nsid, unsigned int actId, MPI_Comm& comm );
-  void genMulticastGroup();
-  void printLocalList();
+  void decodeData( unsigned int pid, EnData& endata );
+  void releaseSideChunk( unsigned int key );  // one use by decoding is done, freed after the last one
+  void restartPhaseMemory();  // the peak resident memory starts from the current one, clears phaseMemoryValid if it cannot
+  void markPhaseMemory();  // peak resident memory since the last restart to phaseMemory, then restart
+  void startParallelDecoder();
+  void joinParallelDecoder();
+  static void* parallelDecoder( void* parg );
+  void storeEncodeData( unsigned int pid );
+  MPI_Comm getMulticastGroup( SubsetSId nsid );
   void writeInputPartitionCollection();
-  void outputLocalList();
-  TrieNode* buildTrie( PartitionList* partitionList, int lower, int upper, unsigned char* prefix, int prefixSize, int maxDepth );
 };
 
 
@@ -3,14 +3,19 @@
 
 #include <vector>
 
+#include "BufferAllocator.h"
+
 using namespace std;
 
 
 #define MAX_FILE_PATH 1024
+#define MAX_NODE 64  // nodes with their own capacity weight
 
 
-typedef vector< unsigned char* > PartitionList; // 分区列表
-typedef vector< unsigned char* > LineList;
+// 分区列表: K - 1 splitters of keySize + 1 bytes. The last byte is the tie fraction, lines with a key
+// equal to the splitter go below it if the hash of their index is < tie / 256 ( 0 = all go above )
+typedef vector< unsigned char* > PartitionList;
+typedef vector< unsigned char*, BufferAllocator< unsigned char* > > LineList;  // lines to sort, pointers only
 
 
 #endif
@@ -1,26 +1,67 @@
 #ifndef _MR_CONFIGURATION
 #define _MR_CONFIGURATION
 
+#include <cstring>
+
+#include "Common.h"
+
 class Configuration {
 
  protected:
   unsigned int numReducer;
   unsigned int numInput;  
   
-  const char *inputPath;
-  const char *outputPath;
-  const char *partitionPath;
+  // Arrays rather than pointers, so the configuration broadcast by the master is valid on every process
+  char inputPath[ MAX_FILE_PATH ];
+  char outputPath[ MAX_FILE_PATH ];
+  char partitionPath[ MAX_FILE_PATH ];
   unsigned long numSamples;
+  bool readInputRange;
+  bool distributedSampling;
+  bool refineSplitter;
+  double balanceEpsilon;
+  bool cachePartitions;
+  bool measureCapacity;
+  double capacity[ MAX_NODE ];
+  unsigned int virtualPartition;
+  unsigned int numSortThread;
+  unsigned long long memoryBudget;
+  char scratchPath[ MAX_FILE_PATH ];
+  bool stream;
+  unsigned long long streamBuffer;
+  unsigned int streamCredit;
+  unsigned int hugePage;
+  int numaNode;
+  unsigned int numTouchThread;
   
  public:
   Configuration() {
     numReducer = 3; // 执行计算的 reducer 节点数量
     numInput = numReducer;    // 输入节点数量
     
-    inputPath = "./Input/Input10000";
-    outputPath = "./Output/Output10000";
-    partitionPath = "./Partition/Partition10000";
+    setInputPath( "./Input/Input10000" );
+    setOutputPath( "./Output/Output10000" );
+    setPartitionPath( "./Partition/Partition10000" );
     numSamples = 10000; // 指定在构建分区列表时的样本数量
+    readInputRange = false;  // read input i as the i-th range of inputPath instead of the split file inputPath_i
+    distributedSampling = false;  // workers sample their own inputs instead of the master sampling the whole input
+    refineSplitter = false;  // adjust the sampled splitters on the keys read by map, see WorkerBase::refineSplitters
+    balanceEpsilon = 0.01;  // refined partitions hold at most ( 1 + balanceEpsilon ) times the average
+    cachePartitions = false;  // reuse the splitters in partitionPath if they were sampled from the same input
+    measureCapacity = false;  // capacity from a sort and map benchmark on every worker at start-up
+    for ( unsigned int i = 0; i < MAX_NODE; i++ ) {
+      capacity[ i ] = 1;  // partition i - 1 of node i is proportional to its capacity
+    }
+    virtualPartition = 1;  // c, sample c * K partitions and give each node a range of them after map
+    numSortThread = 1;  // threads sorting the partitions of a node, see WorkerBase::execReduce
+    memoryBudget = 0;  // bytes of lines a node keeps for REDUCE before spilling a sorted run, 0 = no limit
+    setScratchPath( "/tmp" );  // directory of the spilled runs
+    stream = false;  // map and shuffle overlapped in buffers of streamBuffer bytes per destination ( uncoded )
+    streamBuffer = 1 << 20;
+    streamCredit = 4;  // buffers a node may have in flight to one destination
+    hugePage = 0;  // HugePageMode of the large buffers, see BufferAllocator
+    numaNode = -1;  // node the large buffers are bound to, -1 = none, -2 = node of the worker
+    numTouchThread = 1;  // threads faulting in the pages of a new large buffer, 1 = on first use
   }
   ~Configuration() {}
   const static unsigned int KEY_SIZE = 10; // 键的大小
@@ -39,6 +80,50 @@ class Configuration {
   unsigned int getValueSize() const { return VALUE_SIZE; } // 获取值的大小
   unsigned int getLineSize() const { return KEY_SIZE + VALUE_SIZE; } // 获取键值对的大小
   unsigned long getNumSamples() const { return numSamples; }  // 获取样本数量
+  bool getReadInputRange() const { return readInputRange; }
+  bool getDistributedSampling() const { return distributedSampling; }
+  bool getRefineSplitter() const { return refineSplitter; }
+  double getBalanceEpsilon() const { return balanceEpsilon; }
+  bool getCachePartitions() const { return cachePartitions; }
+  bool getMeasureCapacity() const { return measureCapacity; }
+  double getCapacity( unsigned int i ) const { return i < MAX_NODE ? capacity[ i ] : 1; }
+  unsigned int getVirtualPartition() const { return virtualPartition; }
+  unsigned int getNumPartition() const { return numReducer * virtualPartition; }  // splitters + 1
+  // Share of partition i when sampling, virtual partitions are equal and the capacities apply to their assignment
+  double getPartitionCapacity( unsigned int i ) const { return virtualPartition > 1 ? 1 : getCapacity( i ); }
+  unsigned int getNumSortThread() const { return numSortThread; }
+  unsigned long long getMemoryBudget() const { return memoryBudget; }
+  const char *getScratchPath() const { return scratchPath; }
+  bool getStream() const { return stream; }
+  unsigned long long getStreamBuffer() const { return streamBuffer; }
+  unsigned int getStreamCredit() const { return streamCredit; }
+  unsigned int getHugePage() const { return hugePage; }
+  int getNumaNode() const { return numaNode; }
+  unsigned int getNumTouchThread() const { return numTouchThread; }
+
+  void setNumReducer( unsigned int _numReducer ) { numReducer = _numReducer; }
+  void setNumInput( unsigned int _numInput ) { numInput = _numInput; }
+  void setInputPath( const char* path ) { strncpy( inputPath, path, MAX_FILE_PATH - 1 ); inputPath[ MAX_FILE_PATH - 1 ] = '\0'; }
+  void setOutputPath( const char* path ) { strncpy( outputPath, path, MAX_FILE_PATH - 1 ); outputPath[ MAX_FILE_PATH - 1 ] = '\0'; }
+  void setPartitionPath( const char* path ) { strncpy( partitionPath, path, MAX_FILE_PATH - 1 ); partitionPath[ MAX_FILE_PATH - 1 ] = '\0'; }
+  void setNumSamples( unsigned long _numSamples ) { numSamples = _numSamples; }
+  void setReadInputRange( bool _readInputRange ) { readInputRange = _readInputRange; }
+  void setDistributedSampling( bool _distributedSampling ) { distributedSampling = _distributedSampling; }
+  void setRefineSplitter( bool _refineSplitter ) { refineSplitter = _refineSplitter; }
+  void setBalanceEpsilon( double _balanceEpsilon ) { balanceEpsilon = _balanceEpsilon; }
+  void setCachePartitions( bool _cachePartitions ) { cachePartitions = _cachePartitions; }
+  void setMeasureCapacity( bool _measureCapacity ) { measureCapacity = _measureCapacity; }
+  void setCapacity( unsigned int i, double _capacity ) { capacity[ i ] = _capacity; }
+  void setVirtualPartition( unsigned int _virtualPartition ) { virtualPartition = _virtualPartition; }
+  void setNumSortThread( unsigned int _numSortThread ) { numSortThread = _numSortThread; }
+  void setMemoryBudget( unsigned long long _memoryBudget ) { memoryBudget = _memoryBudget; }
+  void setStream( bool _stream ) { stream = _stream; }
+  void setStreamBuffer( unsigned long long _streamBuffer ) { streamBuffer = _streamBuffer; }
+  void setStreamCredit( unsigned int _streamCredit ) { streamCredit = _streamCredit; }
+  void setHugePage( unsigned int _hugePage ) { hugePage = _hugePage; }
+  void setNumaNode( int _numaNode ) { numaNode = _numaNode; }
+  void setNumTouchThread( unsigned int _numTouchThread ) { numTouchThread = _numTouchThread; }
+  void setScratchPath( const char* path ) { strncpy( scratchPath, path, MAX_FILE_PATH - 1 ); scratchPath[ MAX_FILE_PATH - 1 ] = '\0'; }
 };
 
 #endif
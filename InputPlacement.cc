@@ -1,101 +1,101 @@
 #include <mpi.h>
 #include <iostream>
 #include <fstream>
+#include <cstdio>
+#include <algorithm>
+#include <assert.h>
 
+#include "Common.h"
 #include "Configuration.h"
 #include "CodedConfiguration.h"
 #include "CodeGeneration.h"
 
 #define BUFF_SIZE 1000000   // 1MB
-#define MAX_FILE_PATH 128
 
 using namespace std;
 
+// Sends the split inputs from the master to the workers, which write them as PATH_<i>.
+// Takes the same options as TeraSort, e.g. mpirun -np 5 ./InputPlacement --mode uncoded -K 4
 int main( int argc, char* argv[] )
 {
-  Configuration uncodedConf;
-  CodedConfiguration codedConf;
-  Configuration* conf;
-  bool isCode = argc > 1;
-  CodeGeneration* cg = NULL;
+  // Initialize OpenMPI
+  MPI_Init( &argc, &argv );
+  int nodeRank;
+  MPI_Comm_rank( MPI_COMM_WORLD, &nodeRank );
+  int nodeTotal;
+  MPI_Comm_size( MPI_COMM_WORLD, &nodeTotal );
 
   // Initialize configuration, which is known to all nodes
-  if( !isCode ) {
-    conf = &uncodedConf;
+  CodedConfiguration conf;
+  if( !conf.parseArgs( argc, argv ) ) {
+    if( nodeRank == 0 ) {
+      CodedConfiguration::printUsage( argv[ 0 ] );
+    }
+    MPI_Finalize();
+    return 1;
   }
-  else {
-    conf = &codedConf;
-    cg = new CodeGeneration( conf->getNumInput(), conf->getNumReducer(), ((CodedConfiguration*) conf)->getLoad() );
+  bool isCode = conf.isCoded();
+  CodeGeneration* cg = NULL;
+  if( isCode ) {
+    cg = new CodeGeneration( conf.getNumInput(), conf.getNumReducer(), conf.getLoad() );
   }
 
-  // Initialize OpenMPI
-  MPI_Init(NULL, NULL);
-  int nodeRank;
-  MPI_Comm_rank(MPI_COMM_WORLD, &nodeRank);
-  unsigned int nodeTotal;
-  MPI_Comm_size(MPI_COMM_WORLD, &nodeTotal);
-
-  if (nodeTotal != conf->getNumReducer() + 1) {
-    if (nodeRank == 0) {
+  if( nodeTotal != ( int ) conf.getNumReducer() + 1 ) {
+    if( nodeRank == 0 ) {
       cout << "The number of workers mismatches the number of processes.\n";
     }
+    delete cg;
     MPI_Finalize();
-    return 0;
+    return 1;
   }
 
 
   // Master or Workers
   if( nodeRank == 0 ) {
-    ifstream inputFile( conf->getInputPath(), ios::in | ios::binary | ios::ate );
+    ifstream inputFile( conf.getInputPath(), ios::in | ios::binary | ios::ate );
     if ( !inputFile.is_open() ) {
-      cout << "Cannot open input file " << conf->getInputPath() << endl;
+      cout << "Cannot open input file " << conf.getInputPath() << endl;
       assert( false );
     }
-    cout << "inputFile " << conf->getInputPath() << " is open\n";
-    
-    unsigned int numInput = conf->getNumInput();
-    unsigned int LineSize = conf->getLineSize();
+    cout << "inputFile " << conf.getInputPath() << " is open\n";
+
+    unsigned int numInput = conf.getNumInput();
+    unsigned int LineSize = conf.getLineSize();
     unsigned long long int fileSize = inputFile.tellg();
     unsigned long long int numLine = fileSize / LineSize;
 
     // Assume that the number of lines is higher than the number of workers
     assert( numInput <= numLine );
-    assert( numInput > 1 );        
+    assert( numInput > 1 );
 
     // Split input file equally except the last split that possible includes extra lines
     unsigned long long int splitSize = ( numLine / numInput ) * LineSize;
 
     char* buff = new char[ BUFF_SIZE ];
-    if ( buff == NULL ) {
-      cout << "Cannot allocate buffer for splitting\n";
-      assert( false );
-    }
 
     // Send each input
-    for ( unsigned int i = 0; i < (unsigned int) numInput; i++ ) {
+    for ( unsigned int i = 0; i < numInput; i++ ) {
       unsigned int fid = i + 1;
       unsigned long long startIndex = i * splitSize;
       unsigned long long endIndex = ( i != numInput - 1 ) ? ( i + 1 ) * splitSize - 1 : fileSize - 1;
       unsigned long long totalSize = endIndex - startIndex + 1;
-      unsigned long long currIndex = startIndex;      
+      unsigned long long currIndex = startIndex;
       unsigned long long copySize;
-      MPI::Intracomm mgComm;      
+      MPI_Comm mgComm = MPI_COMM_NULL;
 
-      cout << "Sending file " << fid << endl;      
+      cout << "Sending file " << fid << endl;
       // Initial transmission
       if( !isCode ) {
-	MPI::COMM_WORLD.Send( &totalSize, 1, MPI::UNSIGNED_LONG_LONG, fid, 0 );
+	MPI_Send( &totalSize, 1, MPI_UNSIGNED_LONG_LONG, fid, 0, MPI_COMM_WORLD );
       }
       else {
-	// create multicast domain
-	//NodeSet& ns = cg->getNodeSetFromFileID( fid );	
-	int color = 1;
-	mgComm = MPI::COMM_WORLD.Split( color, nodeRank );
-	mgComm.Bcast( &totalSize, 1, MPI::UNSIGNED_LONG_LONG, 0 );
+	// create multicast domain: the master and the nodes having the file
+	MPI_Comm_split( MPI_COMM_WORLD, 1, nodeRank, &mgComm );
+	MPI_Bcast( &totalSize, 1, MPI_UNSIGNED_LONG_LONG, 0, mgComm );
       }
 
       // read split and send to workers
-      inputFile.seekg( startIndex );      
+      inputFile.seekg( startIndex );
       while( currIndex <= endIndex ) {
 	copySize = min( (unsigned long long) BUFF_SIZE, endIndex - currIndex + 1 );
 	inputFile.read( buff, copySize );
@@ -103,22 +103,22 @@ int main( int argc, char* argv[] )
 
 	// send to workers
 	if( !isCode ) {
-	  MPI::COMM_WORLD.Send( buff, copySize, MPI::CHAR, fid, 0 );
+	  MPI_Send( buff, copySize, MPI_CHAR, fid, 0, MPI_COMM_WORLD );
 	}
 	else {
-	  mgComm.Bcast( buff, copySize, MPI::CHAR, 0 );
+	  MPI_Bcast( buff, copySize, MPI_CHAR, 0, mgComm );
 	}
       }
 
       // Free multicast group
       if( isCode ) {
-	mgComm.Free();
+	MPI_Comm_free( &mgComm );
       }
     }
 
     // cleanup
     inputFile.close();
-    delete [] buff;  
+    delete [] buff;
   }
   else {
     // Worker side (receive input files)
@@ -130,8 +130,8 @@ int main( int argc, char* argv[] )
 
     if( !isCode ) {
       // Uncode
-      MPI::COMM_WORLD.Recv( &totalSize, 1, MPI::UNSIGNED_LONG_LONG, 0, 0 );
-      sprintf( filePath, "%s_%d", conf->getInputPath(), nodeRank - 1 );
+      MPI_Recv( &totalSize, 1, MPI_UNSIGNED_LONG_LONG, 0, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE );
+      snprintf( filePath, MAX_FILE_PATH, "%s_%d", conf.getInputPath(), nodeRank - 1 );
       ofstream inputFile( filePath, ios::out | ios::binary | ios::trunc );
       if ( !inputFile.is_open() ) {
 	cout << "Cannot open input file " << filePath << endl;
@@ -140,29 +140,25 @@ int main( int argc, char* argv[] )
       currSize = 0;
       while( currSize < totalSize ) {
 	recvSize = min( (unsigned long long) BUFF_SIZE, totalSize - currSize );
-	MPI::COMM_WORLD.Recv( buff, recvSize, MPI::CHAR, 0, 0 );
+	MPI_Recv( buff, recvSize, MPI_CHAR, 0, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE );
 	inputFile.write( buff, recvSize );
 	currSize += recvSize;
       }
       inputFile.close();
-    } 
+    }
     else {
       //Code
-      unsigned int numInput = conf->getNumInput();
+      unsigned int numInput = conf.getNumInput();
       for( unsigned int i = 0; i < numInput; i++ ) {
 	unsigned int fid = i + 1;
 
 	// create multicast domain
-	NodeSet& ns = cg->getNodeSetFromFileID( fid );
-	int color = ( ns.find( nodeRank ) != ns.end() ) ? 1 : 0;
-	MPI::Intracomm mgComm = MPI::COMM_WORLD.Split( color, nodeRank );
-	if( color == 0 ) {
-	  // No file to receive with respect to this subset
-	  continue;
-	}
-	else {
-	  mgComm.Bcast( &totalSize, 1, MPI::UNSIGNED_LONG_LONG, 0 );
-	  sprintf( filePath, "%s_%d", conf->getInputPath(), fid - 1 );
+	int color = ( cg->getNodeMaskFromFileID( fid ) & CodeGeneration::nodeBit( nodeRank ) ) ? 1 : 0;
+	MPI_Comm mgComm;
+	MPI_Comm_split( MPI_COMM_WORLD, color, nodeRank, &mgComm );
+	if( color == 1 ) {
+	  MPI_Bcast( &totalSize, 1, MPI_UNSIGNED_LONG_LONG, 0, mgComm );
+	  snprintf( filePath, MAX_FILE_PATH, "%s_%d", conf.getInputPath(), fid - 1 );
 	  ofstream inputFile( filePath, ios::out | ios::binary | ios::trunc );
 	  if ( !inputFile.is_open() ) {
 	    cout << "Cannot open input file " << filePath << endl;
@@ -171,17 +167,19 @@ int main( int argc, char* argv[] )
 	  currSize = 0;
 	  while( currSize < totalSize ) {
 	    recvSize = min( (unsigned long long) BUFF_SIZE, totalSize - currSize );
-	    mgComm.Bcast( buff, recvSize, MPI::CHAR, 0 );
+	    MPI_Bcast( buff, recvSize, MPI_CHAR, 0, mgComm );
 	    inputFile.write( buff, recvSize );
 	    currSize += recvSize;
 	  }
 	  inputFile.close();
 	}
-	mgComm.Free();
+	// No file to receive with respect to this subset otherwise
+	MPI_Comm_free( &mgComm );
       }
     }
     delete [] buff;
   }
-  MPI::Finalize();
+  delete cg;
+  MPI_Finalize();
   return 0;
 }
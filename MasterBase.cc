@@ -0,0 +1,95 @@
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <assert.h>
+#include <mpi.h>
+
+#include "MasterBase.h"
+
+using namespace std;
+
+MasterBase::~MasterBase()
+{
+  if ( partitionList != NULL ) {
+    for ( auto it = partitionList->begin(); it != partitionList->end(); it++ ) {
+      delete [] *it;
+    }
+    delete partitionList;
+  }
+}
+
+
+void MasterBase::setupPartitions()
+{
+  Configuration* conf = getConfiguration();
+
+  // CAPACITY OF THE WORKERS, relative to node 1. 各工作节点的处理能力，分区大小与其成正比
+  if ( conf->getMeasureCapacity() ) {
+    double rate = 0;
+    double rcvRate[ conf->getNumReducer() + 1 ];
+    MPI_Gather( &rate, 1, MPI_DOUBLE, rcvRate, 1, MPI_DOUBLE, 0, MPI_COMM_WORLD );
+    cout << rank << ": CAPACITY|";
+    for ( unsigned int i = 1; i <= conf->getNumReducer(); i++ ) {
+      conf->setCapacity( i - 1, rcvRate[ i ] / rcvRate[ 1 ] );
+      cout << " " << setprecision( 3 ) << conf->getCapacity( i - 1 );
+    }
+    cout << setprecision( 6 ) << endl;
+  }
+
+  // SPLITTERS SAVED FOR THE SAME INPUT, neither the master nor the workers sample then
+  double sampleTime = MPI_Wtime();
+  partitioner.setConfiguration( conf );
+  partitionList = conf->getCachePartitions() ? partitioner.loadPartitions() : NULL;
+  bool cached = partitionList != NULL;
+  if ( cached ) {
+    conf->setDistributedSampling( false );
+  }
+  sampleTime = MPI_Wtime() - sampleTime;
+
+  // BROADCAST CONFIGURATION TO WORKERS
+  // Note: this works because the number of partitions can be derived from the number of workers in the configuration.
+  MPI_Bcast( ( void* ) conf, getConfigurationSize(), MPI_CHAR, 0, MPI_COMM_WORLD );
+
+  // GENERATE LIST OF PARTITIONS ( sampled here, or by the workers on their own inputs )
+  sampleTime -= MPI_Wtime();
+  if ( !cached ) {
+    partitionList = conf->getDistributedSampling() ? partitioner.gatherPartitions() : partitioner.createPartitions();
+    if ( conf->getCachePartitions() ) {
+      partitioner.savePartitions( *partitionList );
+    }
+  }
+  sampleTime += MPI_Wtime();
+  cout << rank << ": SAMPLE  | Time = " << setw(10) << sampleTime << ( cached ? "   Cached" : "" ) << endl;
+
+  // BROADCAST PARTITIONS TO WORKERS
+  for ( auto it = partitionList->begin(); it != partitionList->end(); it++ ) {
+    unsigned char* partition = *it;
+    MPI_Bcast( partition, conf->getKeySize() + 1, MPI_UNSIGNED_CHAR, 0, MPI_COMM_WORLD );
+  }
+}
+
+
+double MasterBase::gatherTime( const char* phase )
+{
+  int numWorker = getConfiguration()->getNumReducer();
+  double rcvTime[ numWorker + 1 ];
+  double rTime = 0;
+  MPI_Gather( &rTime, 1, MPI_DOUBLE, rcvTime, 1, MPI_DOUBLE, 0, MPI_COMM_WORLD );
+  double avgTime = 0;
+  double maxTime = 0;
+  for ( int i = 1; i <= numWorker; i++ ) {
+    avgTime += rcvTime[ i ];
+    maxTime = max( maxTime, rcvTime[ i ] );
+  }
+  cout << rank << ": " << phase << "| Avg = " << setw(10) << avgTime / numWorker
+       << "   Max = " << setw(10) << maxTime;
+  return maxTime;
+}
+
+
+void MasterBase::printPred( double time )
+{
+  if ( predicted ) {
+    cout << "   Pred = " << setw(10) << time;
+  }
+}
@@ -0,0 +1,42 @@
+#ifndef _MR_MASTERBASE
+#define _MR_MASTERBASE
+
+#include <cstddef>
+
+#include "Configuration.h"
+#include "Common.h"
+#include "PartitionSampling.h"
+#include "Planner.h"
+
+using namespace std;
+
+// Steps shared by the uncoded and the coded master: capacity of the workers, the configuration,
+// the splitters and the timing lines of the phases.
+class MasterBase
+{
+ protected:
+  unsigned int rank;
+  unsigned int totalNode;
+  PartitionSampling partitioner;
+  PartitionList* partitionList;
+  bool predicted;
+  Planner::PhaseTime pred;  // of the planner that chose the algorithm, if predicted
+
+ public:
+ MasterBase( unsigned int _rank, unsigned int _totalNode ): rank( _rank ), totalNode( _totalNode ), partitionList( NULL ), predicted( false ) {}
+  virtual ~MasterBase();
+  void setPrediction( const Planner::PhaseTime& _pred ) { pred = _pred; predicted = true; }
+
+ protected:
+  virtual Configuration* getConfiguration() = 0;
+  virtual size_t getConfigurationSize() const = 0;  // bytes broadcast to the workers
+  // Capacity of the workers, the configuration, then splitters loaded, sampled here or gathered from
+  // the workers, broadcast to them ( master side of WorkerBase::receivePartitions )
+  void setupPartitions();
+  // Time of a phase from every worker, printed as "PHASE   | Avg = ..   Max = .." without the end of line.
+  // Returns the largest time.
+  double gatherTime( const char* phase );
+  void printPred( double time );  // "   Pred = .." after the timing line, if predicted
+};
+
+#endif
@@ -0,0 +1,60 @@
+#include <iostream>
+
+#include "MulticastScheduler.h"
+
+using namespace std;
+
+MulticastScheduler::MulticastScheduler( CodeGeneration* cg )
+{
+  // Greedy coloring of the conflict graph: two multicasts conflict if they
+  // share the sender or the subset. Every node computes the same schedule.
+  vector< vector< bool > > senderBusy;  // [ round ][ node id ]
+  vector< unsigned int > senderNext( cg->getK() + 1, 0 );  // first round that may be free for a sender
+
+  for( SubsetSId sid = 0; sid < cg->getNumSubsetS(); sid++ ) {
+    NodeMask mask = cg->getSubsetSMask( sid );
+    vector< unsigned int > subsetRounds;
+    int rootId = 0;
+    for( ; mask != 0; mask &= mask - 1, rootId++ ) {
+      int sender = __builtin_ctzll( mask ) + 1;
+      unsigned int r = senderNext[ sender ];
+      while( true ) {
+	if( r == rounds.size() ) {
+	  rounds.push_back( MulticastRound() );
+	  senderBusy.push_back( vector< bool >( cg->getK() + 1, false ) );
+	}
+	bool used = false;
+	for( auto rit = subsetRounds.begin(); rit != subsetRounds.end(); rit++ ) {
+	  used = used || *rit == r;
+	}
+	if( !senderBusy[ r ][ sender ] && !used ) {
+	  break;
+	}
+	r++;
+      }
+
+      Multicast mc;
+      mc.sid = sid;
+      mc.sender = sender;
+      mc.rootId = rootId;
+      rounds[ r ].push_back( mc );
+      senderBusy[ r ][ sender ] = true;
+      subsetRounds.push_back( r );
+      while( senderNext[ sender ] < rounds.size() && senderBusy[ senderNext[ sender ] ][ sender ] ) {
+	senderNext[ sender ]++;
+      }
+    }
+  }
+}
+
+
+void MulticastScheduler::printSchedule()
+{
+  for( unsigned int r = 0; r < rounds.size(); r++ ) {
+    cout << "Round " << r << ":";
+    for( auto mit = rounds[ r ].begin(); mit != rounds[ r ].end(); mit++ ) {
+      cout << " ( " << mit->sender << ", " << mit->sid << " )";
+    }
+    cout << endl;
+  }
+}
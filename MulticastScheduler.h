@@ -0,0 +1,32 @@
+#ifndef _CMR_MULTICASTSCHEDULER
+#define _CMR_MULTICASTSCHEDULER
+
+#include <vector>
+
+#include "CodeGeneration.h"
+
+using namespace std;
+
+typedef struct _Multicast {
+  SubsetSId sid;
+  int sender;   // node id
+  int rootId;   // rank of the sender in the multicast group
+} Multicast;
+typedef vector< Multicast > MulticastRound;
+
+// Groups the (sender, subset) multicasts of the coded shuffle into rounds.
+// Within a round no node sends twice and no subset is used twice, so all
+// multicasts of a round can be in flight at the same time.
+class MulticastScheduler {
+ private:
+  vector< MulticastRound > rounds;
+
+ public:
+  MulticastScheduler( CodeGeneration* cg );
+  ~MulticastScheduler() {}
+
+  vector< MulticastRound >& getRounds() { return rounds; }
+  void printSchedule();
+};
+
+#endif
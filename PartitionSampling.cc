@@ -5,6 +5,10 @@
 #include <cmath>
 #include <assert.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <mpi.h>
 
 #include "PartitionSampling.h"
 #include "Common.h"
@@ -13,7 +17,7 @@ using namespace std;
 
 PartitionSampling::PartitionSampling() // 构造函数
 {
-  conf = NULL;2
+  conf = NULL;
 }
 
 PartitionSampling::~PartitionSampling()
@@ -28,69 +32,267 @@ PartitionList* PartitionSampling::createPartitions()
     assert( false );
   }
 
-  ifstream inputFile( conf->getInputPath(), ios::in | ios::binary | ios::ate ); // 以二进制读写方式打开输入文件
-  
-  if ( !inputFile.is_open() ) { // 如果文件打开失败
-    cout << "Cannot open input file " << conf->getInputPath() << endl; 
+  // Sample keys evenly over the whole input 从输入文件中等间隔抽取指定数量的样本记录
+  unsigned long long numLine = getFileSize( conf->getInputPath() ) / conf->getLineSize();
+  long unsigned int numSamples = min( ( unsigned long long ) conf->getNumSamples(), numLine ); // 用户设定的采样数和文件的行数相比较，选择小的那个作为采样数 numSamples
+  vector< unsigned char > keys( numSamples * conf->getKeySize() );
+  sampleKeys( conf->getInputPath(), 0, numLine, numSamples, conf, &keys[ 0 ] );
+  return createPartitions( keys );
+}
+
+
+PartitionList* PartitionSampling::gatherPartitions()
+{
+  // Keys sampled by the workers, the master itself contributes none
+  int numProc;
+  MPI_Comm_size( MPI_COMM_WORLD, &numProc );
+  int size = 0;
+  vector< int > count( numProc );
+  MPI_Gather( &size, 1, MPI_INT, &count[ 0 ], 1, MPI_INT, 0, MPI_COMM_WORLD );
+  vector< int > displ( numProc, 0 );
+  for ( int i = 1; i < numProc; i++ ) {
+    displ[ i ] = displ[ i - 1 ] + count[ i - 1 ];
+  }
+  vector< unsigned char > keys( displ[ numProc - 1 ] + count[ numProc - 1 ] );
+  MPI_Gatherv( NULL, 0, MPI_UNSIGNED_CHAR, keys.empty() ? NULL : &keys[ 0 ], &count[ 0 ], &displ[ 0 ], MPI_UNSIGNED_CHAR, 0, MPI_COMM_WORLD );
+  return createPartitions( keys );
+}
+
+
+void PartitionSampling::getFingerprint( Fingerprint& fp ) const
+{
+  memset( &fp, 0, sizeof( Fingerprint ) );  // padding is compared too
+  struct stat st;
+  if ( stat( conf->getInputPath(), &st ) != 0 ) {
+    cout << "Cannot open input file " << conf->getInputPath() << endl;
     assert( false );
   }
+  fp.size = st.st_size;
+  fp.mtimeSec = st.st_mtim.tv_sec;
+  fp.mtimeNsec = st.st_mtim.tv_nsec;
+  fp.numReducer = conf->getNumPartition();
+  fp.keySize = conf->getKeySize();
+  fp.numSamples = conf->getNumSamples();
 
-  
-  PartitionList keyList; 
-  long unsigned int keySize = conf->getKeySize();   // 键的大小
-  unsigned long fileSize = inputFile.tellg();     // tellg()表示当前读取位置与输入文件开头之间的字节数 也就是输入文件的大小
-  long unsigned int numSamples = min( conf->getNumSamples(), fileSize / conf->getLineSize() ); // 用户设定的采样数和文件的行数相比较，选择小的那个作为采样数 numSamples
+  // FNV-1a of FINGERPRINT_LINES whole lines spread over the file
+  int fd = open( conf->getInputPath(), O_RDONLY );
+  unsigned long long lineSize = conf->getLineSize();
+  unsigned long long numLine = fp.size / lineSize;
+  unsigned char line[ lineSize ];
+  fp.hash = 14695981039346656037ULL;
+  for ( unsigned int i = 0; i < FINGERPRINT_LINES && i < numLine; i++ ) {
+    unsigned long long offset = i * numLine / FINGERPRINT_LINES * lineSize;
+    if ( pread( fd, line, lineSize, offset ) != ( ssize_t ) lineSize ) {
+      cout << "Cannot read input file " << conf->getInputPath() << endl;
+      assert( false );
+    }
+    for ( unsigned long long j = 0; j < lineSize; j++ ) {
+      fp.hash = ( fp.hash ^ line[ j ] ) * 1099511628211ULL;
+    }
+  }
+  close( fd );
 
-  
-  // Sample keys 从输入文件中随机抽取指定数量的样本记录，并将这些样本记录存储在一个键列表（keyList）数据结构中。
-  inputFile.seekg( 0 ); // 将文件指针移动到文件开头
-  long unsigned int gapSkip = ( ( fileSize / conf->getLineSize() ) / numSamples - 1 ) * conf->getLineSize(); 
-  /*
-    gapSkip 是指两个样本记录之间的跨度，表示一个样本和下一个样本之间在输入文件中的距离。
-    fileSize 表示输入文件的大小，conf->getLineSize() 表示每行记录的长度，numSamples 表示要采样的记录数量。
-    这个公式实际上是为了保证每个样本之间的间距尽可能相等，从而能够更精确地代表整个数据集。程序使用这个 gapSkip 值来控制在每轮循环读取样本记录时向前移动文件指针的距离。
-    因此，每次执行完这条语句后，文件指针会向前移动 conf->getValueSize() + gapSkip 个字节，从而指向下一个样本记录的开头位置，以便程序能够读取和处理下一个样本记录。
-    为了让样本记录集合是具有充分代表性
-  */
-  for ( long unsigned int i = 0; i < numSamples; i++ ) { // 从输入文件中随机抽取指定数量的样本记录
-    unsigned char *keyBuff = new unsigned char [ keySize + 1 ];
-    if ( keyBuff == NULL ) {
-      cout << "Cannot allocate memory to sample keys.\n"; // 防止在从输入文件中抽取样本记录时，因为内存不足而无法为样本记录分配内存空间
+  // The capacities move the splitters too
+  for ( unsigned int i = 0; i < fp.numReducer; i++ ) {
+    double capacity = conf->getPartitionCapacity( i );
+    unsigned char* c = ( unsigned char* ) &capacity;
+    for ( unsigned int j = 0; j < sizeof( double ); j++ ) {
+      fp.hash = ( fp.hash ^ c[ j ] ) * 1099511628211ULL;
+    }
+  }
+}
+
+
+PartitionList* PartitionSampling::loadPartitions()
+{
+  ifstream partitionFile( conf->getPartitionPath(), ios::in | ios::binary );
+  if ( !partitionFile.is_open() ) {
+    return NULL;
+  }
+  Fingerprint fp;
+  Fingerprint saved;
+  getFingerprint( fp );
+  partitionFile.read( ( char* ) &saved, sizeof( Fingerprint ) );
+  if ( !partitionFile || memcmp( &fp, &saved, sizeof( Fingerprint ) ) != 0 ) {
+    return NULL;
+  }
+
+  PartitionList* partitions = new PartitionList;
+  unsigned long keySize = conf->getKeySize();
+  for ( unsigned int i = 1; i < conf->getNumPartition(); i++ ) {
+    unsigned char* keyBuff = new unsigned char[ keySize + 1 ];
+    partitionFile.read( ( char* ) keyBuff, keySize + 1 );
+    partitions->push_back( keyBuff );
+  }
+  if ( !partitionFile ) {
+    for ( auto k = partitions->begin(); k != partitions->end(); ++k ) {
+      delete [] (*k);
+    }
+    delete partitions;
+    return NULL;
+  }
+  return partitions;
+}
+
+
+void PartitionSampling::savePartitions( const PartitionList& partitions )
+{
+  // Splitters with their tie fractions after the fingerprint
+  ofstream partitionFile( conf->getPartitionPath(), ios::out | ios::binary | ios::trunc );
+  if ( !partitionFile.is_open() ) {
+    cout << "Cannot write partition file " << conf->getPartitionPath() << endl;
+    return;
+  }
+  Fingerprint fp;
+  getFingerprint( fp );
+  partitionFile.write( ( char* ) &fp, sizeof( Fingerprint ) );
+  for ( auto k = partitions.begin(); k != partitions.end(); ++k ) {
+    partitionFile.write( ( char* ) *k, conf->getKeySize() + 1 );
+  }
+  partitionFile.close();
+}
+
+
+vector< unsigned int > PartitionSampling::assignPartitions()
+{
+  // Lines of each virtual partition summed over the workers. Every node gets a range of partitions
+  // with its share of the lines, ranges rather than a packing so the outputs stay in key order.
+  unsigned int numPartition = conf->getNumPartition();
+  unsigned int numReducer = conf->getNumReducer();
+  vector< unsigned long long > count( numPartition, 0 );
+  MPI_Reduce( MPI_IN_PLACE, &count[ 0 ], numPartition, MPI_UNSIGNED_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD );
+
+  unsigned long long total = 0;
+  for ( unsigned int i = 0; i < numPartition; i++ ) {
+    total += count[ i ];
+  }
+  double totalCapacity = 0;
+  for ( unsigned int i = 0; i < numReducer; i++ ) {
+    totalCapacity += conf->getCapacity( i );
+  }
+  vector< double > target( numReducer );  // lines up to the end of node i + 1
+  double capacity = 0;
+  for ( unsigned int i = 0; i < numReducer; i++ ) {
+    capacity += conf->getCapacity( i );
+    target[ i ] = total * capacity / totalCapacity;
+  }
+
+  // A partition goes to the node whose range holds its middle line
+  vector< unsigned int > owner( numPartition );
+  vector< unsigned long long > load( numReducer, 0 );
+  unsigned int node = 0;
+  double below = 0;
+  for ( unsigned int i = 0; i < numPartition; i++ ) {
+    while ( node + 1 < numReducer && below + count[ i ] / 2.0 > target[ node ] ) {
+      node++;
+    }
+    owner[ i ] = node;
+    load[ node ] += count[ i ];
+    below += count[ i ];
+  }
+  MPI_Bcast( &owner[ 0 ], numPartition, MPI_UNSIGNED, 0, MPI_COMM_WORLD );
+
+  double maxShare = 0;
+  for ( unsigned int i = 0; i < numReducer && total > 0; i++ ) {
+    maxShare = max( maxShare, load[ i ] / ( total * conf->getCapacity( i ) / totalCapacity ) );
+  }
+  cout << "0: ASSIGN  | Partitions = " << setw(10) << numPartition << "   Max / Share = " << setw(10) << maxShare << endl;
+  return owner;
+}
+
+
+void PartitionSampling::sendSamples( const vector< unsigned char >& keys )
+{
+  int size = keys.size();
+  MPI_Gather( &size, 1, MPI_INT, NULL, 1, MPI_INT, 0, MPI_COMM_WORLD );
+  MPI_Gatherv( keys.empty() ? NULL : ( void* ) &keys[ 0 ], size, MPI_UNSIGNED_CHAR, NULL, NULL, NULL, MPI_UNSIGNED_CHAR, 0, MPI_COMM_WORLD );
+}
+
+
+unsigned long long PartitionSampling::getFileSize( const char* path )
+{
+  struct stat st;
+  if ( stat( path, &st ) != 0 ) {
+    cout << "Cannot open input file " << path << endl;
+    assert( false );
+  }
+  return st.st_size;
+}
+
+
+void PartitionSampling::sampleKeys( const char* path, unsigned long long offset, unsigned long long numLine, unsigned long numSamples, const Configuration* conf, unsigned char* keys )
+{
+  // One pread per key, lines evenly spaced in [ offset, offset + numLine lines )
+  int fd = open( path, O_RDONLY );
+  if ( fd < 0 ) {
+    cout << "Cannot open input file " << path << endl;
+    assert( false );
+  }
+  unsigned long long lineSize = conf->getLineSize();
+  unsigned long keySize = conf->getKeySize();
+  for ( unsigned long i = 0; i < numSamples; i++ ) {
+    unsigned long long line = i * numLine / numSamples;
+    if ( pread( fd, keys + i * keySize, keySize, offset + line * lineSize ) != ( ssize_t ) keySize ) {
+      cout << "Cannot read a sample from " << path << endl;
       assert( false );
     }
-    inputFile.read( (char *) keyBuff, keySize );   // 读取样本记录的键
+  }
+  close( fd );
+}
+
+
+PartitionList* PartitionSampling::createPartitions( const vector< unsigned char >& keys )
+{
+  PartitionList keyList; 
+  long unsigned int keySize = conf->getKeySize();   // 键的大小
+  long unsigned int numSamples = keys.size() / keySize;
+  assert( numSamples >= conf->getNumReducer() );
+  for ( long unsigned int i = 0; i < numSamples; i++ ) {
+    unsigned char *keyBuff = new unsigned char [ keySize + 1 ];
+    memcpy( keyBuff, &keys[ i * keySize ], keySize );
     keyBuff[ keySize ] = '\0'; // 将样本记录的键的最后一个字符设置为 '\0'
     keyList.push_back( keyBuff ); // 将样本记录的键添加到键列表中
-    inputFile.seekg( conf->getValueSize() + gapSkip , ios_base::cur ); // 将文件指针向前移动 conf->getValueSize() + gapSkip 个字节
   }
-  inputFile.close(); // 关闭输入文件
   
     
   // Sort sampled keys 按照键的字典序对样本记录的键进行排序
-  stable_sort( keyList.begin(), keyList.end(), cmpKey ); // `stable_sort()` 函数是一个稳定的排序函数，它能够保证排序后的具有相同键值的样本相对位置没有发生改变
+  stable_sort( keyList.begin(), keyList.end(), KeyCmp( keySize ) ); // `stable_sort()` 函数是一个稳定的排序函数，它能够保证排序后的具有相同键值的样本相对位置没有发生改变
   
   /*
     Partition keys 一个键值列表 keyList 划分为多个子列表，每个子列表称作一个 partition，每个 partition 中的键值对都会被发送到同一个 reducer 节点上进行处理。 
   */
   PartitionList* partitions = new PartitionList; 
-  long unsigned int numPartitions = conf->getNumReducer(); //从配置信息中读取 reducer 的数量（即划分的 partition 数量）
-  long unsigned int sizePartition = round( numSamples / numPartitions ); // 每个 partition 中包含的样本记录数量
+  long unsigned int numPartitions = conf->getNumPartition(); //从配置信息中读取 reducer 的数量（即划分的 partition 数量）
+  // Partition i - 1 of node i gets a share of the samples proportional to the capacity of the node
+  double totalCapacity = 0;
+  for ( unsigned long int i = 0; i < numPartitions; i++ ) {
+    totalCapacity += conf->getPartitionCapacity( i );
+  }
+  double capacity = 0;
   for ( unsigned long int i = 1; i < numPartitions; i++ ) { 
     unsigned char *keyBuff = new unsigned char [ keySize + 1 ]; // 为每个 partition 分配内存
     if ( keyBuff == NULL ) { // 如果分配内存失败
       assert( false );
     }
-    memcpy( keyBuff, keyList.at( i * sizePartition ), keySize + 1 ); // 将每个 partition 的第一个元素存储在 keyBuff 中
+    capacity += conf->getPartitionCapacity( i - 1 );
+    long unsigned int split = min( ( long unsigned int ) ( numSamples * capacity / totalCapacity ), numSamples - 1 );
+    memcpy( keyBuff, keyList.at( split ), keySize ); // 将每个 partition 的第一个元素存储在 keyBuff 中
+
+    // Heavy key: the samples equal to the split key are cut at the same position as the samples,
+    // so its lines are spread over all partitions this key bounds. 0 for a key sampled once.
+    long unsigned int lower = split;
+    long unsigned int upper = split + 1;
+    while ( lower > 0 && memcmp( keyList.at( lower - 1 ), keyBuff, keySize ) == 0 ) {
+      lower--;
+    }
+    while ( upper < numSamples && memcmp( keyList.at( upper ), keyBuff, keySize ) == 0 ) {
+      upper++;
+    }
+    keyBuff[ keySize ] = ( split - lower ) * 256 / ( upper - lower );
     partitions->push_back( keyBuff ); // 将 keyBuff 添加到 partitions 中
   }
 
-  // The partition list will be broadcast
-  // Save partitions to partition list file
-  // ofstream partitionFile( conf->getPartitionPath(), ios::out | ios::binary | ios::trunc );
-  // for ( auto k = partitions->begin(); k != partitions->end(); ++k ) {
-  //   partitionFile.write( (char *) *k, keySize );
-  // }
-  // partitionFile.close();
+  // The partition list will be broadcast, and saved by savePartitions when it is cached
   
   // Clean up
   for ( auto k = keyList.begin(); k != keyList.end(); ++k ) { // 释放 keyList 中每个元素所占用的内存
@@ -101,19 +303,10 @@ PartitionList* PartitionSampling::createPartitions()
 }
 
 // 在 MapReduce 计算过程中对键进行排序(分割)。保证每个 reducer 节点处理的键值对数量大致相等。
-// 具体来说，该函数会遍历两个字符串的每一个字符，并进行比较。如果遇到两个不同的字符，则根据它们在字典序中的大小关系返回 true 或者 false，
-// 否则继续比较下一个字符，直到其中一个字符串结束。如果两个字符串相等，则认为前一个字符串小于后一个字符串，返回 true。
-bool PartitionSampling::cmpKey( const unsigned char* keyl, const unsigned char* keyr )
+// 比较两个键的全部 keySize 字节 ( 键中可能有 '\0' )，相等的键返回 false，stable_sort 需要这种严格弱序。
+bool PartitionSampling::KeyCmp::operator()( const unsigned char* keyl, const unsigned char* keyr ) const
 {
-  for ( unsigned long i = 0; keyl[i] != '\0'; i++ ) {
-    if ( keyl[ i ] < keyr[ i ] ) {
-      return true;
-    }
-    else if ( keyl[ i ] > keyr[ i ] ) {
-      return false;
-    }
-  }
-  return true;
+  return memcmp( keyl, keyr, keySize ) < 0;
 }
 
 
@@ -24,10 +24,37 @@ class PartitionSampling {
   具体地，该函数的作用是设置 MapReduce 任务的配置信息。在执行 MapReduce 的过程中，一些参数如 reducer 节点数、输入路径、输出路径等需要在不同阶段进行传递和共享。
   因此，用户可以通过调用 setConfiguration() 函数来设置这些参数，在任务的执行过程中使用。
   */
-  PartitionList* createPartitions(); // 创建分区
+  PartitionList* createPartitions(); // 创建分区，在本进程上对整个输入采样
+  PartitionList* gatherPartitions(); // 创建分区，样本由各个工作节点采集 ( master side of sendSamples )
+  PartitionList* loadPartitions(); // splitters saved in partitionPath for the same input and K, NULL if there are none
+  void savePartitions( const PartitionList& partitions ); // with the fingerprint of the input
+  vector< unsigned int > assignPartitions(); // node - 1 of each virtual partition from the counts of the map ( master side of WorkerBase::receiveAssignment )
+  static void sendSamples( const vector< unsigned char >& keys ); // worker side of gatherPartitions
+  static unsigned long long getFileSize( const char* path );
+  // numSamples keys of lines evenly spaced in numLine lines from byte offset of the file, keySize bytes each
+  static void sampleKeys( const char* path, unsigned long long offset, unsigned long long numLine, unsigned long numSamples, const Configuration* conf, unsigned char* keys );
 
  private:
-  static bool cmpKey( const unsigned char* keyl, const unsigned char* keyr ); // 比较两个键
+  // Identifies the input cheaply: size, modification time and a hash of evenly spaced lines
+  typedef struct _Fingerprint {
+    unsigned long long size;
+    long long mtimeSec;
+    long long mtimeNsec;
+    unsigned long long hash;
+    unsigned int numReducer;
+    unsigned int keySize;
+    unsigned long numSamples;
+  } Fingerprint;
+  const static unsigned int FINGERPRINT_LINES = 64;
+
+  void getFingerprint( Fingerprint& fp ) const;
+  PartitionList* createPartitions( const vector< unsigned char >& keys ); // split points of the sampled keys
+  class KeyCmp { // 比较两个键
+    unsigned int keySize;
+  public:
+    KeyCmp( unsigned int _keySize ): keySize( _keySize ) {}
+    bool operator()( const unsigned char* keyl, const unsigned char* keyr ) const;
+  };
   void printKeys( const PartitionList& keyList ) const; // 打印键
 };
 
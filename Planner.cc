@@ -0,0 +1,232 @@
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <algorithm>
+#include <cfloat>
+#include <string.h>
+#include <assert.h>
+
+#include "Planner.h"
+#include "Common.h"
+#include "Trie.h"
+#include "WorkerBase.h"
+#include "XorKernel.h"
+
+using namespace std;
+
+Planner::Planner( unsigned int _numReducer, unsigned long long _inputSize, unsigned long long _numLine, const Calibration& _cal, bool _copyUnpack ): numReducer( _numReducer ), inputSize( _inputSize ), numLine( _numLine ), cal( _cal ), copyUnpack( _copyUnpack )
+{
+  assert( numReducer > 1 && cal.mcRate.size() == numReducer + 1 );
+}
+
+
+Planner::Calibration Planner::calibrate( const CodedConfiguration& conf, unsigned int rank, MPI_Comm workerComm )
+{
+  unsigned int numReducer = conf.getNumReducer();
+  Calibration cal;
+  double rate[ 4 ] = { DBL_MAX, DBL_MAX, DBL_MAX, DBL_MAX };  // map, copy, xor, sort
+  cal.mcRate.assign( numReducer + 1, 0 );
+  if ( rank == 0 ) {
+    MPI_Reduce( MPI_IN_PLACE, rate, 4, MPI_DOUBLE, MPI_MIN, 0, MPI_COMM_WORLD );
+    cal.mapRate = rate[ 0 ];
+    cal.copyRate = rate[ 1 ];
+    cal.xorRate = rate[ 2 ];
+    cal.sortRate = rate[ 3 ];
+    MPI_Recv( &cal.mcRate[ 0 ], numReducer + 1, MPI_DOUBLE, 1, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE );
+    return cal;
+  }
+
+  // Rates of this node on the first calibrationSize bytes of the input, the slowest node counts
+  unsigned long long lineSize = conf.getLineSize();
+  ifstream inputFile( conf.getInputPath(), ios::in | ios::binary | ios::ate );
+  if ( !inputFile.is_open() ) {
+    cout << rank << ": Cannot open input file " << conf.getInputPath() << endl;
+    assert( false );
+  }
+  unsigned long long numLine = min( ( unsigned long long ) inputFile.tellg(), conf.getCalibrationSize() ) / lineSize;
+  assert( numLine >= numReducer );
+  unsigned long long size = numLine * lineSize;
+  unsigned char* buff = new unsigned char[ size ];
+  unsigned char* part = new unsigned char[ size ];
+
+  // Map: read, then partition by a trie over K - 1 keys picked from the data. Copy: the lines to their partitions
+  double time = MPI_Wtime();
+  inputFile.seekg( 0, ios::beg );
+  inputFile.read( ( char * ) buff, size );
+  inputFile.close();
+  PartitionList keys;
+  for ( unsigned int i = 1; i < numReducer; i++ ) {
+    keys.push_back( buff + ( i * numLine / numReducer ) * lineSize );
+  }
+  sort( keys.begin(), keys.end(), Sorter( conf.getKeySize() ) );
+  unsigned char prefix[ conf.getKeySize() ];
+  TrieNode* calTrie = WorkerBase::buildTrie( &keys, 0, keys.size(), prefix, 0, 2 );
+  vector< unsigned int > lineWid( numLine );
+  vector< unsigned long long > count( numReducer, 0 );
+  for ( unsigned long long i = 0; i < numLine; i++ ) {
+    lineWid[ i ] = calTrie->findPartition( buff + i * lineSize );
+    count[ lineWid[ i ] ]++;
+  }
+  vector< unsigned char* > wptr( numReducer );
+  for ( unsigned int i = 0, acc = 0; i < numReducer; acc += count[ i ], i++ ) {
+    wptr[ i ] = part + acc * lineSize;
+  }
+  double copyTime = MPI_Wtime();
+  for ( unsigned long long i = 0; i < numLine; i++ ) {
+    memcpy( wptr[ lineWid[ i ] ], buff + i * lineSize, lineSize );
+    wptr[ lineWid[ i ] ] += lineSize;
+  }
+  rate[ 1 ] = size / ( MPI_Wtime() - copyTime );
+  rate[ 0 ] = size / ( MPI_Wtime() - time );
+  delete calTrie;
+
+  // XOR: two halves into the partitioned copy, as encoding folds r chunks into one
+  time = MPI_Wtime();
+  const unsigned char* src[ 2 ] = { buff, buff + size / 2 };
+  xorMulti( part, src, 2, size / 2 );
+  rate[ 2 ] = size / ( MPI_Wtime() - time );
+
+  // Sort: lines of the input, as reduce does
+  LineList lines( numLine );
+  for ( unsigned long long i = 0; i < numLine; i++ ) {
+    lines[ i ] = buff + i * lineSize;
+  }
+  time = MPI_Wtime();
+  sort( lines.begin(), lines.end(), Sorter( conf.getKeySize() ) );
+  rate[ 3 ] = size / ( MPI_Wtime() - time );
+  MPI_Reduce( rate, NULL, 4, MPI_DOUBLE, MPI_MIN, 0, MPI_COMM_WORLD );
+
+  // Multicast: worker 1 broadcasts to workers [ 1, g ], one group at a time as in the model
+  for ( unsigned int g = 2; g <= numReducer; g++ ) {
+    MPI_Comm comm;
+    MPI_Comm_split( workerComm, rank <= g ? 0 : MPI_UNDEFINED, rank, &comm );
+    if( comm == MPI_COMM_NULL ) {
+      continue;
+    }
+    MPI_Bcast( buff, lineSize, MPI_UNSIGNED_CHAR, 0, comm );
+    MPI_Barrier( comm );
+    time = MPI_Wtime();
+    MPI_Bcast( buff, size, MPI_UNSIGNED_CHAR, 0, comm );
+    MPI_Barrier( comm );
+    cal.mcRate[ g ] = size / ( MPI_Wtime() - time );
+    MPI_Comm_free( &comm );
+  }
+  if( rank == 1 ) {
+    MPI_Send( &cal.mcRate[ 0 ], numReducer + 1, MPI_DOUBLE, 0, 0, MPI_COMM_WORLD );
+  }
+
+  delete [] buff;
+  delete [] part;
+  return cal;
+}
+
+
+Planner::PhaseTime Planner::predict( unsigned int load )
+{
+  double D = inputSize;
+  double K = numReducer;
+  double r = load;
+  PhaseTime pt;
+  pt.map = D * r / K / cal.mapRate;
+  pt.encode = D * ( K - r ) / ( K * K ) / cal.xorRate;
+  pt.shuffle = D * ( 1 - r / K ) / r / cal.mcRate[ load + 1 ];
+  pt.decode = D * ( K - r ) * ( r - 1 ) / ( K * K ) / cal.xorRate;
+  pt.reduce = D / K / cal.sortRate;
+  return pt;
+}
+
+
+Planner::PhaseTime Planner::predictUncoded()
+{
+  double D = inputSize;
+  double K = numReducer;
+  PhaseTime pt;
+  pt.map = D / K * ( 1 / cal.mapRate - 1 / cal.copyRate );
+  pt.encode = D / K / cal.copyRate;
+  pt.shuffle = D * ( 1 - 1 / K ) / cal.mcRate[ 2 ];
+  pt.decode = copyUnpack ? D / K / cal.copyRate : 0;
+  pt.reduce = D / K / cal.sortRate;
+  return pt;
+}
+
+
+double Planner::getBinom( unsigned int n, unsigned int k )
+{
+  double c = 1;
+  for( unsigned int i = 0; i < k; i++ ) {
+    c = c * ( n - i ) / ( i + 1 );
+  }
+  return c;
+}
+
+
+bool Planner::isFeasible( unsigned int load )
+{
+  return load >= 1 && load < numReducer && getBinom( numReducer, load ) <= numLine;
+}
+
+
+unsigned int Planner::chooseLoad()
+{
+  unsigned int best = 1;
+  double bestTime = getTotal( predict( 1 ) );
+  for( unsigned int r = 2; r < numReducer; r++ ) {
+    if( !isFeasible( r ) ) {
+      continue;
+    }
+    double time = getTotal( predict( r ) );
+    if( time < bestTime ) {
+      best = r;
+      bestTime = time;
+    }
+  }
+  return best;
+}
+
+
+bool Planner::chooseCoded()
+{
+  return getTotal( predict( chooseLoad() ) ) < getTotal( predictUncoded() );
+}
+
+
+void Planner::printPlan( unsigned int rank )
+{
+  cout << rank
+       << ": CALIB   | Map = " << setw(10) << cal.mapRate * 1e-6 << " MB/s"
+       << "   Copy = " << setw(10) << cal.copyRate * 1e-6 << " MB/s"
+       << "   Xor = " << setw(10) << cal.xorRate * 1e-6 << " MB/s"
+       << "   Sort = " << setw(10) << cal.sortRate * 1e-6 << " MB/s"
+       << "   Unicast = " << setw(10) << cal.mcRate[ 2 ] * 8e-6 << " Mbps" << endl;
+  for( unsigned int r = 1; r < numReducer; r++ ) {
+    if( !isFeasible( r ) ) {
+      continue;
+    }
+    PhaseTime pt = predict( r );
+    cout << rank
+	 << ": PLAN    | r = " << setw(2) << r
+	 << "   Map = " << setw(10) << pt.map
+	 << "   Encode = " << setw(10) << pt.encode
+	 << "   Shuffle = " << setw(10) << pt.shuffle
+	 << "   Decode = " << setw(10) << pt.decode
+	 << "   Reduce = " << setw(10) << pt.reduce
+	 << "   Total = " << setw(10) << getTotal( pt )
+	 << "   Multicast = " << setw(10) << cal.mcRate[ r + 1 ] * 8e-6 << " Mbps" << endl;
+  }
+  PhaseTime pt = predictUncoded();
+  cout << rank
+       << ": PLAN    | uncoded"
+       << "   Map = " << setw(10) << pt.map
+       << "   Pack = " << setw(10) << pt.encode
+       << "   Shuffle = " << setw(10) << pt.shuffle
+       << "   Unpack = " << setw(10) << pt.decode
+       << "   Reduce = " << setw(10) << pt.reduce
+       << "   Total = " << setw(10) << getTotal( pt ) << endl;
+  unsigned int r = chooseLoad();
+  if( chooseCoded() ) {
+    cout << rank << ": PLAN    | Choose coded TeraSort, r = " << r << ( r == 1 ? " ( no replication )" : "" ) << endl;
+  }
+  else {
+    cout << rank << ": PLAN    | Choose uncoded TeraSort, faster than coded at r = " << r << endl;
+  }
+}
@@ -0,0 +1,61 @@
+#ifndef _CMR_PLANNER
+#define _CMR_PLANNER
+
+#include <vector>
+#include <mpi.h>
+
+#include "CodedConfiguration.h"
+
+using namespace std;
+
+// Chooses uncoded TeraSort or the computation load r of coded TeraSort from rates measured at start-up.
+// Phase times follow the cost model of the coded TeraSort paper with D input bytes on K nodes:
+//   map D r / K, encode and decode D ( K - r ) / K^2 ( times r - 1 for decode ) XORed bytes,
+//   shuffle D L( r ) with L( r ) = ( 1 - r / K ) / r sent one multicast to r + 1 nodes at a time,
+//   reduce D / K sorted bytes.
+// r = 1 still runs the coded pipeline: every input is on one node, each packet copies a single
+// segment ( encode ) and is sent to a group of 2 nodes, decoding has nothing to XOR.
+// Uncoded TeraSort maps D / K, packs D / K copied bytes, sends D ( 1 - 1 / K ) one unicast at a time,
+// unpacks D / K copied bytes ( none when the partitions are received in place ) and reduces D / K.
+class Planner {
+ public:
+  typedef struct _Calibration {
+    double mapRate;   // input bytes read and partitioned per second, slowest node
+    double copyRate;  // bytes of lines copied to their partitions per second, part of the map, slowest node
+    double xorRate;   // source bytes XORed per second, slowest node
+    double sortRate;  // bytes sorted per second, slowest node
+    vector< double > mcRate;  // [ g ] bytes per second of a multicast to g nodes, g in [ 2, K ]
+  } Calibration;
+
+  typedef struct _PhaseTime {
+    double map;
+    double encode;  // pack if uncoded
+    double shuffle;
+    double decode;  // unpack if uncoded
+    double reduce;
+  } PhaseTime;
+
+ private:
+  unsigned int numReducer;
+  unsigned long long inputSize;  // bytes
+  unsigned long long numLine;
+  Calibration cal;
+  bool copyUnpack;  // uncoded TeraSort copies the partitions to the local list when unpacking
+
+ public:
+  Planner( unsigned int _numReducer, unsigned long long _inputSize, unsigned long long _numLine, const Calibration& _cal, bool _copyUnpack );
+  ~Planner() {}
+
+  // Every process calls it, the workers measure their rates on the input, the master gets the slowest
+  static Calibration calibrate( const CodedConfiguration& conf, unsigned int rank, MPI_Comm workerComm );
+  PhaseTime predict( unsigned int load );
+  PhaseTime predictUncoded();
+  static double getTotal( const PhaseTime& pt ) { return pt.map + pt.encode + pt.shuffle + pt.decode + pt.reduce; }
+  static double getBinom( unsigned int n, unsigned int k );
+  bool isFeasible( unsigned int load );  // every node subset gets at least one line
+  unsigned int chooseLoad();  // feasible load with the lowest predicted total time
+  bool chooseCoded();  // coded TeraSort at chooseLoad() predicted faster than uncoded TeraSort
+  void printPlan( unsigned int rank );
+};
+
+#endif
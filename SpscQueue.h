@@ -0,0 +1,57 @@
+#ifndef _CMR_SPSCQUEUE
+#define _CMR_SPSCQUEUE
+
+#include <atomic>
+#include <vector>
+
+using namespace std;
+
+// Lock-free ring buffer for exactly one producer thread and one consumer thread.
+template< typename T >
+class SpscQueue {
+ private:
+  vector< T > ring;
+  unsigned long mask;
+  // Padding keeps the indices written by producer and consumer on different cache lines
+  char pad0[ 64 ];
+  atomic< unsigned long > head;  // written by the consumer only
+  char pad1[ 64 ];
+  atomic< unsigned long > tail;  // written by the producer only
+  char pad2[ 64 ];
+
+ public:
+  // Capacity is rounded up to a power of two
+ SpscQueue( unsigned long capacity ): head( 0 ), tail( 0 ) {
+    unsigned long size = 1;
+    while( size < capacity ) {
+      size <<= 1;
+    }
+    ring.resize( size );
+    mask = size - 1;
+  }
+  ~SpscQueue() {}
+
+  // Producer side, false if the queue is full
+  bool push( const T& item ) {
+    unsigned long t = tail.load( memory_order_relaxed );
+    if( t - head.load( memory_order_acquire ) > mask ) {
+      return false;
+    }
+    ring[ t & mask ] = item;
+    tail.store( t + 1, memory_order_release );
+    return true;
+  }
+
+  // Consumer side, false if the queue is empty
+  bool pop( T& item ) {
+    unsigned long h = head.load( memory_order_relaxed );
+    if( h == tail.load( memory_order_acquire ) ) {
+      return false;
+    }
+    item = ring[ h & mask ];
+    head.store( h + 1, memory_order_release );
+    return true;
+  }
+};
+
+#endif
@@ -0,0 +1,97 @@
+#include <iostream>
+#include <assert.h>
+
+#include "ThreadPool.h"
+
+using namespace std;
+
+ThreadPool::ThreadPool( unsigned int numThread ): generation( 0 ), numBusy( 0 ), stop( false ), func( NULL ), arg( NULL ), numTask( 0 ), nextTask( 0 )
+{
+  pthread_mutex_init( &lock, NULL );
+  pthread_cond_init( &wake, NULL );
+  pthread_cond_init( &finish, NULL );
+
+  threads.resize( numThread > 1 ? numThread - 1 : 0 );
+  for( unsigned int t = 0; t < threads.size(); t++ ) {
+    if( pthread_create( &threads[ t ], NULL, worker, ( void* ) this ) ) {
+      cout << "Cannot create pool thread\n";
+      assert( false );
+    }
+  }
+}
+
+
+ThreadPool::~ThreadPool()
+{
+  pthread_mutex_lock( &lock );
+  stop = true;
+  pthread_cond_broadcast( &wake );
+  pthread_mutex_unlock( &lock );
+  for( unsigned int t = 0; t < threads.size(); t++ ) {
+    pthread_join( threads[ t ], NULL );
+  }
+
+  pthread_cond_destroy( &finish );
+  pthread_cond_destroy( &wake );
+  pthread_mutex_destroy( &lock );
+}
+
+
+void ThreadPool::run( unsigned long _numTask, TaskFunc _func, void* _arg )
+{
+  pthread_mutex_lock( &lock );
+  func = _func;
+  arg = _arg;
+  numTask = _numTask;
+  nextTask.store( 0 );
+  numBusy = threads.size();
+  generation++;
+  pthread_cond_broadcast( &wake );
+  pthread_mutex_unlock( &lock );
+
+  // The calling thread works too
+  execTasks();
+
+  pthread_mutex_lock( &lock );
+  while( numBusy > 0 ) {
+    pthread_cond_wait( &finish, &lock );
+  }
+  pthread_mutex_unlock( &lock );
+}
+
+
+void ThreadPool::execTasks()
+{
+  unsigned long task;
+  while( ( task = nextTask.fetch_add( 1 ) ) < numTask ) {
+    func( task, arg );
+  }
+}
+
+
+void* ThreadPool::worker( void* ppool )
+{
+  ThreadPool* pool = ( ThreadPool* ) ppool;
+  unsigned long seen = 0;
+  while( true ) {
+    pthread_mutex_lock( &pool->lock );
+    while( !pool->stop && pool->generation == seen ) {
+      pthread_cond_wait( &pool->wake, &pool->lock );
+    }
+    if( pool->stop ) {
+      pthread_mutex_unlock( &pool->lock );
+      break;
+    }
+    seen = pool->generation;
+    pthread_mutex_unlock( &pool->lock );
+
+    pool->execTasks();
+
+    pthread_mutex_lock( &pool->lock );
+    if( --pool->numBusy == 0 ) {
+      pthread_cond_signal( &pool->finish );
+    }
+    pthread_mutex_unlock( &pool->lock );
+  }
+  return NULL;
+}
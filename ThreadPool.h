@@ -0,0 +1,43 @@
+#ifndef _CMR_THREADPOOL
+#define _CMR_THREADPOOL
+
+#include <pthread.h>
+#include <atomic>
+#include <vector>
+
+using namespace std;
+
+// Fixed set of threads running batches of independent tasks.
+// Tasks are claimed one at a time, so threads that finish early take over the remaining ones.
+class ThreadPool {
+ public:
+  typedef void ( *TaskFunc )( unsigned long taskId, void* arg );
+
+ private:
+  vector< pthread_t > threads;
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  pthread_cond_t finish;
+  unsigned long generation;  // batch counter, wakes up the threads
+  unsigned int numBusy;
+  bool stop;
+
+  TaskFunc func;
+  void* arg;
+  unsigned long numTask;
+  atomic< unsigned long > nextTask;
+
+ public:
+  ThreadPool( unsigned int numThread );  // including the calling thread
+  ~ThreadPool();
+
+  // Run func( 0, arg ), ..., func( numTask - 1, arg ) and return when all are done
+  void run( unsigned long numTask, TaskFunc func, void* arg );
+  unsigned int getNumThread() const { return threads.size() + 1; }
+
+ private:
+  void execTasks();
+  static void* worker( void* ppool );
+};
+
+#endif
@@ -2,48 +2,66 @@
 #define _MR_WORKER
 
 #include <unordered_map>
+#include <mpi.h>
 
 #include "Configuration.h"
 #include "Common.h"
 #include "Utility.h"
 #include "Trie.h"
+#include "WorkerBase.h"
 
-class Worker
+class Worker : public WorkerBase
 {
  public:
- /*
-  在 typedef 中，尖括号 "<" 和 ">" 用于指定一个模板类型的参数。在这个例子中，尖括号 "<" 和 ">" 的作用是为 unordered_map 容器类指定键类型。
-  别名可以方便地用于定义和声明 定义的类型的变量 例如：PartitionCollection myMap;
- */
-  typedef unordered_map< unsigned int, LineList* > PartitionCollection;   // 第一个 typedef 定义了一个名为 PartitionCollection 的类型别名，表示一个键为 unsigned int，值为指向 LineList 对象的指针的 unordered_map 容器。该别名可以方便地用于定义和声明 PartitionCollection 类型的变量
-  typedef struct _TxData { // 第二个 typedef 定义了一个名为 TxData 的结构体，其定义了两个属性 data 和 numLine。
+  typedef struct _TxData {
     unsigned char* data; // 表示所有中间结果数据的一个拼接字符串(数据内容)
     unsigned long long numLine; // 表示中间结果的数量
   } TxData;
-  typedef unordered_map< unsigned int, TxData > PartitionPackData;  // 第三个 typedef 定义了一个名为 PartitionPackData 的类型别名，表示一个键为 unsigned int，值为 TxData 结构体类型的 unordered_map 容器。
+  typedef unordered_map< unsigned int, TxData > PartitionPackData;  // key = destID - 1
+
+  // One destination of the stream, see execStream
+  typedef struct _StreamPeer {
+    vector< unsigned char* > txBuff;  // credit + 1 buffers used in turn, txBuff[ txCur ] is being filled
+    vector< MPI_Request > txReq;
+    unsigned int txCur;
+    unsigned long long txLine;  // lines in txBuff[ txCur ]
+    unsigned int credit;  // buffers the destination can still receive
+    vector< unsigned char* > rxBuff;  // one posted receive per credit
+    int creditIn;
+    bool done;  // the empty buffer closing the stream was received
+  } StreamPeer;
+  const static int TAG_STREAM_DATA = 1;
+  const static int TAG_STREAM_CREDIT = 2;
 
  private:
-  const Configuration* conf; //指针类型的常量
-  unsigned int rank;
-  PartitionList partitionList; // 分区列表 用于存储分区数据
-  PartitionCollection partitionCollection; // partitionCollection[i] 表示第 i 个分区，它对应的值是一个指向行数据列表的指针。而该列表的大小就是分区中行的数量
-  PartitionPackData partitionTxData; // 存储发送者节点的中间结果数据 数组的下标从 0 开始，对应的节点编号则从 1 开始
+  Configuration* conf;
+  unsigned char* inputData;  // lines of input rank - 1
+  unsigned long long numInputLine;
+  vector< unsigned int > lineWid;  // partition of each input line
+  PartitionPackData partitionTxData; // 存储发送者节点的中间结果数据，包括本节点自己的分区
   PartitionPackData partitionRxData; // 存储接收者节点的中间结果数据 数组的下标从 0 开始，对应的节点编号则从 1 开始
-  LineList localList; // 本地列表
-  TrieNode* trie;// 前缀树
+  vector< unsigned long long > rxOffset;  // line of localArena where the partition from node i starts, key = i - 1
+  vector< StreamPeer > streamPeer;  // key = destID
+  vector< MPI_Request > streamReq;  // receives of peer j: data at j * ( credit + 1 ) + c, credit at j * ( credit + 1 ) + credit
+  vector< MPI_Request > creditReq;  // credits granted
+  unsigned long long streamLine;  // lines per buffer
+  unsigned long long streamByte;  // bytes sent
 
  public:
- Worker( unsigned int _rank ): rank( _rank ) {} // 构造函数,与Master 构造函数不同,这里只有一个参数,但语法上是一样的
+ Worker( unsigned int _rank, const Configuration& _conf ): WorkerBase( _rank ), conf( new Configuration( _conf ) ), inputData( NULL ) {}
   ~Worker();
   void run();
 
  private:
+  const Configuration* getConfiguration() const { return conf; }
   void execMap(); // 执行map
-  void execReduce();// 执行reduce
-  void printLocalList(); // 打印本地列表
-  void printPartitionCollection();// 打印分区集合
-  void outputLocalList();// 输出本地列表
-  TrieNode* buildTrie( PartitionList* partitionList, int lower, int upper, unsigned char* prefix, int prefixSize, int maxDepth );// 构建前缀树
+  void execPack(); // 按分区打包
+  void execShuffle();
+  void execUnpack(); // 本节点的分区和收到的分区放入 localList
+  void execStream();  // MAP, PACK, SHUFFLE and UNPACK overlapped
+  void sendStream( unsigned int dest );  // txBuff being filled, an empty one ends the stream
+  void progressStream( bool block );  // received buffers to localList, credits back
+  void receiveStream( unsigned int index, MPI_Status& status, bool drain );  // drain: stream closing, no new receive or credit
 };
 
 
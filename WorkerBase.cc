@@ -0,0 +1,580 @@
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <cstdio>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+#include <queue>
+#include <unistd.h>
+#include <assert.h>
+#include <mpi.h>
+
+#include "WorkerBase.h"
+#include "PartitionSampling.h"
+#include "ThreadPool.h"
+#include "BufferAllocator.h"
+
+using namespace std;
+
+WorkerBase::~WorkerBase()
+{
+  delete trie;
+  for ( auto it = partitionList.begin(); it != partitionList.end(); ++it ) {
+    delete [] *it;
+  }
+  if ( localArena != NULL ) {
+    freeBuffer( localArena );
+  }
+  else {
+    for ( auto it = localList.begin(); it != localList.end(); ++it ) {
+      delete [] *it;
+    }
+  }
+}
+
+
+void WorkerBase::receivePartitions()
+{
+  const Configuration* conf = getConfiguration();
+  for ( unsigned int i = 1; i < conf->getNumPartition(); i++ ) {
+    unsigned char* buff = new unsigned char[ conf->getKeySize() + 1 ];
+    MPI_Bcast( buff, conf->getKeySize() + 1, MPI_UNSIGNED_CHAR, 0, MPI_COMM_WORLD );
+    partitionList.push_back( buff );
+  }
+
+  unsigned char prefix[ conf->getKeySize() ];
+  trie = buildTrie( &partitionList, 0, partitionList.size(), prefix, 0, 2 );
+
+  // Node i owns partition i - 1 unless there are virtual partitions
+  partitionOwner.resize( conf->getNumPartition() );
+  for ( unsigned int i = 0; i < conf->getNumPartition(); i++ ) {
+    partitionOwner[ i ] = i / conf->getVirtualPartition();
+  }
+}
+
+
+void WorkerBase::receiveAssignment( const vector< unsigned long long >& count )
+{
+  MPI_Reduce( &count[ 0 ], NULL, count.size(), MPI_UNSIGNED_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD );
+  MPI_Bcast( &partitionOwner[ 0 ], partitionOwner.size(), MPI_UNSIGNED, 0, MPI_COMM_WORLD );
+}
+
+
+void WorkerBase::getInputRange( unsigned int inputId, char* filePath, unsigned long long& offset, unsigned long long& numLine )
+{
+  // The split file, or the same range of the whole input as InputSplitter would cut
+  const Configuration* conf = getConfiguration();
+  if( conf->getReadInputRange() ) {
+    sprintf( filePath, "%s", conf->getInputPath() );
+  }
+  else {
+    sprintf( filePath, "%s_%d", conf->getInputPath(), inputId - 1 );
+  }
+
+  unsigned long long lineSize = conf->getLineSize();
+  offset = 0;
+  numLine = PartitionSampling::getFileSize( filePath ) / lineSize;
+  if( conf->getReadInputRange() ) {
+    unsigned long long splitLine = numLine / conf->getNumInput();
+    offset = ( inputId - 1 ) * splitLine * lineSize;
+    numLine = inputId == conf->getNumInput() ? numLine - ( inputId - 1 ) * splitLine : splitLine;
+  }
+}
+
+
+unsigned char* WorkerBase::readInput( unsigned int inputId, unsigned long long& numLine )
+{
+  const Configuration* conf = getConfiguration();
+  char filePath[ MAX_FILE_PATH ];
+  unsigned long long offset;
+  getInputRange( inputId, filePath, offset, numLine );
+  ifstream inputFile( filePath, ios::in | ios::binary );
+  if ( !inputFile.is_open() ) {
+    cout << rank << ": Cannot open input file " << filePath << endl;
+    assert( false );
+  }
+
+  // Read the whole input at once
+  unsigned long long lineSize = conf->getLineSize();
+  unsigned char* buff = allocBuffer( numLine * lineSize );
+  inputFile.seekg( offset, ios::beg );
+  inputFile.read( ( char * ) buff, numLine * lineSize );
+  inputFile.close();
+  return buff;
+}
+
+
+void WorkerBase::execCapacity()
+{
+  // Partition and sort CAPACITY_LINES synthetic lines, the same work as MAP and REDUCE
+  const Configuration* conf = getConfiguration();
+  const unsigned long long CAPACITY_LINES = 50000;
+  unsigned long long lineSize = conf->getLineSize();
+  unsigned int numReducer = conf->getNumReducer();
+  unsigned char* buff = new unsigned char[ CAPACITY_LINES * lineSize ];
+  unsigned char* part = new unsigned char[ CAPACITY_LINES * lineSize ];
+  unsigned long long seed = 0x2545F4914F6CDD1DULL;
+  for ( unsigned long long i = 0; i < CAPACITY_LINES * lineSize; i++ ) {
+    seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+    buff[ i ] = seed >> 56;
+  }
+
+  double time = MPI_Wtime();
+  vector< unsigned long long > count( numReducer + 1, 0 );
+  for ( unsigned long long i = 0; i < CAPACITY_LINES; i++ ) {
+    count[ buff[ i * lineSize ] * numReducer / 256 + 1 ]++;
+  }
+  for ( unsigned int i = 1; i <= numReducer; i++ ) {
+    count[ i ] += count[ i - 1 ];
+  }
+  LineList lines( CAPACITY_LINES );
+  for ( unsigned long long i = 0; i < CAPACITY_LINES; i++ ) {
+    unsigned char* line = part + count[ buff[ i * lineSize ] * numReducer / 256 ]++ * lineSize;
+    memcpy( line, buff + i * lineSize, lineSize );
+    lines[ i ] = line;
+  }
+  sort( lines.begin(), lines.end(), Sorter( conf->getKeySize() ) );
+  double rate = CAPACITY_LINES / ( MPI_Wtime() - time );
+
+  delete [] buff;
+  delete [] part;
+  MPI_Gather( &rate, 1, MPI_DOUBLE, NULL, 1, MPI_DOUBLE, 0, MPI_COMM_WORLD );
+}
+
+
+void WorkerBase::execSampling( const vector< unsigned int >& inputs )
+{
+  // Every input is sampled by one node, numSamples / N keys each
+  const Configuration* conf = getConfiguration();
+  unsigned long numSamples = max( conf->getNumSamples() / conf->getNumInput(), 1UL );
+  unsigned long keySize = conf->getKeySize();
+  vector< unsigned char > keys;
+  for ( auto it = inputs.begin(); it != inputs.end(); ++it ) {
+    char filePath[ MAX_FILE_PATH ];
+    unsigned long long offset;
+    unsigned long long numLine;
+    getInputRange( *it, filePath, offset, numLine );
+    unsigned long ns = min( ( unsigned long long ) numSamples, numLine );
+    if ( ns == 0 ) {
+      continue;
+    }
+    keys.resize( keys.size() + ns * keySize );
+    PartitionSampling::sampleKeys( filePath, offset, numLine, ns, conf, &keys[ keys.size() - ns * keySize ] );
+  }
+  PartitionSampling::sendSamples( keys );
+}
+
+
+unsigned int WorkerBase::findPartition( unsigned char* line, unsigned long long index )
+{
+  unsigned int keySize = getConfiguration()->getKeySize();
+  unsigned int upper = trie->findPartition( line );
+  if ( upper == 0 || partitionList[ upper - 1 ][ keySize ] == 0 || memcmp( line, partitionList[ upper - 1 ], keySize ) != 0 ) {
+    return upper;
+  }
+
+  // Key equals splitters lower - 1 .. upper - 1, any partition from lower to upper keeps the order
+  unsigned int lower = upper - 1;
+  while ( lower > 0 && memcmp( line, partitionList[ lower - 1 ], keySize ) == 0 ) {
+    lower--;
+  }
+  index += 0x9E3779B97F4A7C15ULL;
+  index = ( index ^ ( index >> 30 ) ) * 0xBF58476D1CE4E5B9ULL;
+  index = ( index ^ ( index >> 27 ) ) * 0x94D049BB133111EBULL;
+  unsigned int hash = ( index ^ ( index >> 31 ) ) >> 56;
+  for ( unsigned int i = lower; i < upper; i++ ) {
+    if ( hash < partitionList[ i ][ keySize ] ) {
+      return i;
+    }
+  }
+  return upper;
+}
+
+
+// Keys as 80-bit big-endian numbers, so a splitter can be moved to the middle of two keys
+typedef unsigned __int128 KeyValue;
+
+static KeyValue toKeyValue( const unsigned char* key, unsigned int keySize )
+{
+  KeyValue v = 0;
+  for ( unsigned int i = 0; i < keySize; i++ ) {
+    v = ( v << 8 ) | key[ i ];
+  }
+  return v;
+}
+
+
+static void fromKeyValue( KeyValue v, unsigned char* key, unsigned int keySize )
+{
+  for ( int i = keySize - 1; i >= 0; i-- ) {
+    key[ i ] = v & 0xFF;
+    v >>= 8;
+  }
+}
+
+
+void WorkerBase::refineSplitters( const vector< unsigned char* >& data, const vector< unsigned long long >& numLine )
+{
+  // Histogram sort: every round counts the keys below and equal to each candidate splitter on all
+  // workers, then bisects the splitters whose count is off the target by more than epsilon / 2 of the
+  // smallest partition. When the target falls inside the lines of one key the tie fraction splits them instead.
+  // Line goes to partition i if splitter[ i - 1 ] <= key < splitter[ i ], as in LeafTrieNode.
+  const Configuration* conf = getConfiguration();
+  unsigned int keySize = conf->getKeySize();
+  unsigned long long lineSize = conf->getLineSize();
+  unsigned int numSplitter = partitionList.size();
+
+  vector< KeyValue > keys;
+  for ( unsigned int d = 0; d < data.size(); d++ ) {
+    for ( unsigned long long l = 0; l < numLine[ d ]; l++ ) {
+      keys.push_back( toKeyValue( data[ d ] + l * lineSize, keySize ) );
+    }
+  }
+  sort( keys.begin(), keys.end() );
+
+  unsigned long long total = keys.size();
+  MPI_Allreduce( MPI_IN_PLACE, &total, 1, MPI_UNSIGNED_LONG_LONG, MPI_SUM, workerComm );
+  // Lines below splitter i and in partition i, in proportion to the capacities of the nodes
+  vector< double > target( numSplitter + 1 );
+  vector< double > share( numSplitter + 1 );
+  double totalCapacity = 0;
+  for ( unsigned int i = 0; i <= numSplitter; i++ ) {
+    totalCapacity += conf->getPartitionCapacity( i );
+  }
+  double capacity = 0;
+  for ( unsigned int i = 0; i <= numSplitter; i++ ) {
+    capacity += conf->getPartitionCapacity( i );
+    share[ i ] = total * conf->getPartitionCapacity( i ) / totalCapacity;
+    target[ i ] = total * capacity / totalCapacity;
+  }
+  double tol = conf->getBalanceEpsilon() * *min_element( share.begin(), share.end() ) / 2;
+
+  vector< KeyValue > cand( numSplitter );
+  vector< unsigned char > tie( numSplitter );
+  vector< KeyValue > lo( numSplitter, 0 );
+  vector< KeyValue > hi( numSplitter, ( KeyValue ) 1 << ( 8 * keySize ) );
+  for ( unsigned int i = 0; i < numSplitter; i++ ) {
+    cand[ i ] = toKeyValue( partitionList[ i ], keySize );
+    tie[ i ] = partitionList[ i ][ keySize ];
+  }
+
+  // count[ i ] = lines below splitter i, count[ numSplitter + i ] = lines equal to it
+  vector< unsigned long long > count( 2 * numSplitter );
+  vector< double > below( numSplitter );
+  unsigned int round = 0;
+  unsigned int maxRound = 8 * keySize + 64;  // bisection of every key bit, then tie fraction steps
+  const char* stop = NULL;  // why refinement ended above 1 + epsilon
+  double maxPart = 0;
+  while ( true ) {
+    round++;
+    for ( unsigned int i = 0; i < numSplitter; i++ ) {
+      auto range = equal_range( keys.begin(), keys.end(), cand[ i ] );
+      count[ i ] = range.first - keys.begin();
+      count[ numSplitter + i ] = range.second - range.first;
+    }
+    MPI_Allreduce( MPI_IN_PLACE, &count[ 0 ], 2 * numSplitter, MPI_UNSIGNED_LONG_LONG, MPI_SUM, workerComm );
+
+    maxPart = 0;
+    for ( unsigned int i = 0; i <= numSplitter; i++ ) {
+      if ( i < numSplitter ) {
+	below[ i ] = count[ i ] + count[ numSplitter + i ] * tie[ i ] / 256.0;
+      }
+      double upper = i < numSplitter ? below[ i ] : total;
+      double lower = i > 0 ? below[ i - 1 ] : 0;
+      maxPart = max( maxPart, ( upper - lower ) / share[ i ] );
+    }
+    if ( maxPart <= 1 + conf->getBalanceEpsilon() ) {
+      break;
+    }
+    if ( round == maxRound ) {
+      stop = "iteration cap reached";
+      break;
+    }
+
+    // Every worker takes the same steps from the same counts
+    bool moved = false;
+    for ( unsigned int i = 0; i < numSplitter; i++ ) {
+      unsigned long long equal = count[ numSplitter + i ];
+      if ( fabs( below[ i ] - target[ i ] ) <= tol ) {
+	continue;
+      }
+      if ( equal > 0 && count[ i ] <= target[ i ] && target[ i ] <= count[ i ] + equal ) {
+	unsigned char t = min( ( target[ i ] - count[ i ] ) * 256 / equal, 255.0 );
+	moved = moved || t != tie[ i ];
+	tie[ i ] = t;
+	continue;
+      }
+      if ( below[ i ] < target[ i ] ) {
+	lo[ i ] = cand[ i ] + 1;
+      }
+      else {
+	hi[ i ] = cand[ i ];
+      }
+      if ( lo[ i ] < hi[ i ] ) {
+	cand[ i ] = lo[ i ] + ( hi[ i ] - lo[ i ] ) / 2;
+	tie[ i ] = 0;
+	moved = true;
+      }
+    }
+    if ( !moved ) {
+      stop = "no splitter can move";
+      break;
+    }
+  }
+
+  vector< pair< KeyValue, unsigned char > > splitter( numSplitter );
+  for ( unsigned int i = 0; i < numSplitter; i++ ) {
+    splitter[ i ] = make_pair( cand[ i ], tie[ i ] );
+  }
+  sort( splitter.begin(), splitter.end() );
+  for ( unsigned int i = 0; i < numSplitter; i++ ) {
+    fromKeyValue( splitter[ i ].first, partitionList[ i ], keySize );
+    partitionList[ i ][ keySize ] = splitter[ i ].second;
+  }
+  delete trie;
+  unsigned char prefix[ keySize ];
+  trie = buildTrie( &partitionList, 0, partitionList.size(), prefix, 0, 2 );
+
+  if ( rank == 1 ) {
+    cout << rank << ": REFINE  | Rounds = " << setw(10) << round
+	 << "   Max / Share = " << setw(10) << maxPart;
+    if ( stop != NULL ) {
+      cout << "   above 1 + " << conf->getBalanceEpsilon() << ", " << stop;
+    }
+    cout << endl;
+  }
+}
+
+
+typedef struct _SortTask {
+  vector< LineList >* part;
+  unsigned int keySize;
+} SortTask;
+
+
+void WorkerBase::execSortTask( unsigned long taskId, void* arg )
+{
+  SortTask* task = ( SortTask* ) arg;
+  LineList& lines = task->part->at( taskId );
+  sort( lines.begin(), lines.end(), Sorter( task->keySize ) );
+}
+
+
+void WorkerBase::execReduce()
+{
+  const Configuration* conf = getConfiguration();
+  if ( conf->getNumSortThread() == 1 || conf->getVirtualPartition() == 1 ) {
+    sort( localList.begin(), localList.end(), Sorter( conf->getKeySize() ) );
+  }
+  else {
+    // Partitions are key ranges, each sorted on its own and concatenated in order is sorted
+    vector< LineList > part( conf->getNumPartition() );
+    for ( auto it = localList.begin(); it != localList.end(); ++it ) {
+      part[ trie->findPartition( *it ) ].push_back( *it );
+    }
+    SortTask task = { &part, conf->getKeySize() };
+    ThreadPool pool( conf->getNumSortThread() );
+    pool.run( part.size(), execSortTask, ( void* ) &task );
+    localList.clear();
+    for ( auto it = part.begin(); it != part.end(); ++it ) {
+      localList.insert( localList.end(), it->begin(), it->end() );
+    }
+  }
+
+  if ( !spillRun.empty() ) {
+    mergeRuns();
+  }
+}
+
+
+void WorkerBase::addLocalLine( const unsigned char* line )
+{
+  const Configuration* conf = getConfiguration();
+  unsigned long long lineSize = conf->getLineSize();
+  unsigned char* buff = new unsigned char[ lineSize ];
+  memcpy( buff, line, lineSize );
+  localList.push_back( buff );
+  if ( conf->getMemoryBudget() > 0 && localList.size() * ( lineSize + sizeof( unsigned char* ) ) >= conf->getMemoryBudget() ) {
+    spillLocalList();
+  }
+}
+
+
+unsigned char* WorkerBase::newLocalArena( unsigned long long numLine )
+{
+  unsigned long long lineSize = getConfiguration()->getLineSize();
+  localArena = allocBuffer( numLine * lineSize );
+  localList.resize( numLine );
+  for ( unsigned long long l = 0; l < numLine; l++ ) {
+    localList[ l ] = localArena + l * lineSize;
+  }
+  return localArena;
+}
+
+
+void WorkerBase::spillLocalList()
+{
+  // Lines are copied into blocks of SPILL_BLOCK bytes, so the run is written sequentially
+  const Configuration* conf = getConfiguration();
+  const unsigned long long SPILL_BLOCK = 4 << 20;
+  unsigned long long lineSize = conf->getLineSize();
+  sort( localList.begin(), localList.end(), Sorter( conf->getKeySize() ) );
+
+  char path[ MAX_FILE_PATH ];
+  snprintf( path, MAX_FILE_PATH, "%s/TeraSort_%d_%u_%lu", conf->getScratchPath(), getpid(), rank, spillRun.size() );
+  FILE* runFile = fopen( path, "wb" );
+  if ( runFile == NULL ) {
+    cout << rank << ": Cannot create run file " << path << endl;
+    assert( false );
+  }
+  unsigned long long blockLine = max( SPILL_BLOCK / lineSize, 1ULL );
+  unsigned char* block = new unsigned char[ blockLine * lineSize ];
+  for ( unsigned long long i = 0; i < localList.size(); i += blockLine ) {
+    unsigned long long numLine = min( blockLine, localList.size() - i );
+    for ( unsigned long long l = 0; l < numLine; l++ ) {
+      memcpy( block + l * lineSize, localList[ i + l ], lineSize );
+      delete [] localList[ i + l ];
+    }
+    if ( fwrite( block, lineSize, numLine, runFile ) != numLine ) {
+      cout << rank << ": Cannot write run file " << path << endl;
+      assert( false );
+    }
+  }
+  delete [] block;
+  fclose( runFile );
+  localList.clear();
+  spillRun.push_back( path );
+}
+
+
+typedef struct _MergeSource {
+  FILE* file;  // NULL for the lines in memory
+  unsigned char* line;  // current line
+  unsigned long long next;  // next line in memory
+} MergeSource;
+
+
+void WorkerBase::mergeRuns()
+{
+  // k-way merge with a heap of the current line of every source, runs are read through a
+  // stdio buffer of their part of the memory budget so that reads stay large and sequential
+  const Configuration* conf = getConfiguration();
+  unsigned long long lineSize = conf->getLineSize();
+  unsigned int keySize = conf->getKeySize();
+  unsigned long long budget = conf->getMemoryBudget() > 0 ? conf->getMemoryBudget() : 64 << 20;
+  size_t buffSize = min( max( budget / ( spillRun.size() + 2 ), 64ULL << 10 ), 16ULL << 20 );
+
+  vector< MergeSource > source( spillRun.size() + 1 );
+  vector< vector< char > > ioBuff( spillRun.size() + 1, vector< char >( buffSize ) );
+  for ( unsigned int i = 0; i < spillRun.size(); i++ ) {
+    source[ i ].file = fopen( spillRun[ i ].c_str(), "rb" );
+    if ( source[ i ].file == NULL ) {
+      cout << rank << ": Cannot open run file " << spillRun[ i ] << endl;
+      assert( false );
+    }
+    setvbuf( source[ i ].file, &ioBuff[ i ][ 0 ], _IOFBF, buffSize );
+    source[ i ].line = new unsigned char[ lineSize ];
+  }
+  MergeSource& memory = source[ spillRun.size() ];
+  memory.file = NULL;
+  memory.line = NULL;
+  memory.next = 0;
+
+  auto later = [ keySize ]( const pair< unsigned char*, unsigned int >& a, const pair< unsigned char*, unsigned int >& b ) {
+    return cmpKey( b.first, a.first, keySize );
+  };
+  priority_queue< pair< unsigned char*, unsigned int >, vector< pair< unsigned char*, unsigned int > >, decltype( later ) > heap( later );
+  auto advance = [ & ]( unsigned int i ) {
+    MergeSource& src = source[ i ];
+    if ( src.file != NULL ) {
+      if ( fread( src.line, lineSize, 1, src.file ) == 1 ) {
+	heap.push( make_pair( src.line, i ) );
+      }
+    }
+    else if ( src.next < localList.size() ) {
+      heap.push( make_pair( localList[ src.next++ ], i ) );
+    }
+  };
+  for ( unsigned int i = 0; i < source.size(); i++ ) {
+    advance( i );
+  }
+
+  char path[ MAX_FILE_PATH ];
+  sprintf( path, "%s_%u", conf->getOutputPath(), rank - 1 );
+  FILE* outputFile = fopen( path, "wb" );
+  if ( outputFile == NULL ) {
+    cout << rank << ": Cannot create output file " << path << endl;
+    assert( false );
+  }
+  setvbuf( outputFile, &ioBuff[ spillRun.size() ][ 0 ], _IOFBF, buffSize );
+  while ( !heap.empty() ) {
+    pair< unsigned char*, unsigned int > top = heap.top();
+    heap.pop();
+    fwrite( top.first, lineSize, 1, outputFile );
+    advance( top.second );
+  }
+  fclose( outputFile );
+
+  if ( rank == 1 ) {
+    cout << rank << ": MERGE   | Runs = " << setw(10) << spillRun.size() << "   Buffer = " << setw(10) << buffSize << endl;
+  }
+  for ( unsigned int i = 0; i < spillRun.size(); i++ ) {
+    fclose( source[ i ].file );
+    delete [] source[ i ].line;
+    unlink( spillRun[ i ].c_str() );
+  }
+  spillRun.clear();
+  outputMerged = true;
+}
+
+
+void WorkerBase::printLocalList()
+{
+  unsigned long int i = 0;
+  for ( auto it = localList.begin(); it != localList.end(); ++it ) {
+    cout << rank << ": " << i++ << "| ";
+    printKey( *it, getConfiguration()->getKeySize() );
+    cout << endl;
+  }
+}
+
+
+void WorkerBase::outputLocalList()
+{
+  if ( outputMerged ) {
+    return;
+  }
+  const Configuration* conf = getConfiguration();
+  char buff[ MAX_FILE_PATH ];
+  sprintf( buff, "%s_%u", conf->getOutputPath(), rank - 1 );
+  ofstream outputFile( buff, ios::out | ios::binary | ios::trunc );
+  for ( auto it = localList.begin(); it != localList.end(); ++it ) {
+    outputFile.write( ( char* ) *it, conf->getLineSize() );
+  }
+  outputFile.close();
+}
+
+
+TrieNode* WorkerBase::buildTrie( PartitionList* partitionList, int lower, int upper, unsigned char* prefix, int prefixSize, int maxDepth )
+{
+  if ( prefixSize >= maxDepth || lower == upper ) {
+    return new LeafTrieNode( prefixSize, partitionList, lower, upper );
+  }
+  InnerTrieNode* result = new InnerTrieNode( prefixSize );
+  int curr = lower;
+  for ( unsigned char ch = 0; ch < 255; ch++ ) {
+    prefix[ prefixSize ] = ch;
+    lower = curr;
+    while( curr < upper ) {
+      if( cmpKey( prefix, partitionList->at( curr ), prefixSize + 1 ) ) {
+	break;
+      }
+      curr++;
+    }
+    result->setChild( ch, buildTrie( partitionList, lower, curr, prefix, prefixSize + 1, maxDepth ) );
+  }
+  prefix[ prefixSize ] = 255;
+  result->setChild( 255, buildTrie( partitionList, curr, upper, prefix, prefixSize + 1, maxDepth ) );
+  return result;
+}
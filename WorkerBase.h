@@ -0,0 +1,62 @@
+#ifndef _MR_WORKERBASE
+#define _MR_WORKERBASE
+
+#include <mpi.h>
+#include <string>
+
+#include "Configuration.h"
+#include "Common.h"
+#include "Utility.h"
+#include "Trie.h"
+
+using namespace std;
+
+// Steps shared by the uncoded and the coded worker: partitions from the master, reading an input,
+// sorting and writing the local list.
+class WorkerBase
+{
+ protected:
+  unsigned int rank;
+  PartitionList partitionList;
+  LineList localList;
+  unsigned char* localArena;  // buffer of the lines of localList, see newLocalArena
+  TrieNode* trie;
+  MPI_Comm workerComm;  // all workers, node i is rank i - 1
+  vector< string > spillRun;  // sorted runs of localList in the scratch directory
+  bool outputMerged;  // the runs were merged into the output by execReduce
+  vector< unsigned int > partitionOwner;  // node - 1 of each partition, set by the master with virtual partitions
+
+ public:
+ WorkerBase( unsigned int _rank ): rank( _rank ), localArena( NULL ), trie( NULL ), workerComm( MPI_COMM_NULL ), outputMerged( false ) {}
+  virtual ~WorkerBase();
+  void setWorkerComm( MPI_Comm& comm ) { workerComm = comm; }
+  // Trie over the sorted keys [ lower, upper ) of partitionList, see Planner::calibrate for a use outside the workers
+  static TrieNode* buildTrie( PartitionList* partitionList, int lower, int upper, unsigned char* prefix, int prefixSize, int maxDepth );
+
+ protected:
+  virtual const Configuration* getConfiguration() const = 0;
+  void receivePartitions();  // broadcast by the master, then build the trie
+  void getInputRange( unsigned int inputId, char* filePath, unsigned long long& offset, unsigned long long& numLine );  // where input inputId ( from 1 ) is
+  unsigned char* readInput( unsigned int inputId, unsigned long long& numLine );  // whole lines of input inputId
+  void execCapacity();  // lines per second of a map and sort benchmark to the master, see Configuration::capacity
+  void execSampling( const vector< unsigned int >& inputs );  // keys of these inputs to the master, see PartitionSampling::gatherPartitions
+  // Partition of a line, lines with a heavy key are spread by index ( same on every node )
+  unsigned int findPartition( unsigned char* line, unsigned long long index );
+  // Lines of each virtual partition to the master, the owners back, see PartitionSampling::assignPartitions
+  void receiveAssignment( const vector< unsigned long long >& count );
+  // Move the splitters until no partition of the lines in data holds more than ( 1 + epsilon ) times its share
+  void refineSplitters( const vector< unsigned char* >& data, const vector< unsigned long long >& numLine );
+  void addLocalLine( const unsigned char* line );  // copy to localList, spilled when over the memory budget
+  // One buffer of numLine lines for the partition of the node, localList points into it.
+  // Lines are written into it directly instead of through addLocalLine. Lines the derived
+  // worker adds to localList besides these stay owned by it.
+  unsigned char* newLocalArena( unsigned long long numLine );
+  void spillLocalList();  // localList sorted to a new run
+  void execReduce();  // partition by partition on numSortThread threads if there are several, then mergeRuns
+  static void execSortTask( unsigned long taskId, void* arg );
+  void mergeRuns();  // runs and the sorted localList into the output file
+  void printLocalList();
+  void outputLocalList();
+};
+
+#endif
@@ -0,0 +1,305 @@
+#include <string.h>
+#include <stdint.h>
+
+#include "XorKernel.h"
+
+#if defined( __x86_64__ ) || defined( __i386__ )
+#define XOR_X86
+#include <immintrin.h>
+#endif
+
+typedef void ( *XorMultiFunc )( unsigned char*, const unsigned char*, const unsigned char* const*, unsigned int, unsigned long long );
+
+
+// Kernels compute dst = base ^ srcs, in place when dst is base.
+
+// Scalar kernel, 8 bytes at a time. Also used for the tails of the vector kernels.
+static void xorMultiScalar( unsigned char* dst, const unsigned char* base, const unsigned char* const* srcs, unsigned int numSrc, unsigned long long size )
+{
+  unsigned long long i = 0;
+  for( ; i + sizeof( uint64_t ) <= size; i += sizeof( uint64_t ) ) {
+    uint64_t d;
+    memcpy( &d, base + i, sizeof( uint64_t ) );
+    for( unsigned int s = 0; s < numSrc; s++ ) {
+      uint64_t v;
+      memcpy( &v, srcs[ s ] + i, sizeof( uint64_t ) );
+      d ^= v;
+    }
+    memcpy( dst + i, &d, sizeof( uint64_t ) );
+  }
+  for( ; i < size; i++ ) {
+    unsigned char d = base[ i ];
+    for( unsigned int s = 0; s < numSrc; s++ ) {
+      d ^= srcs[ s ][ i ];
+    }
+    dst[ i ] = d;
+  }
+}
+
+
+#ifdef XOR_X86
+
+// Each vector kernel handles 4 vectors per iteration, then single vectors, then hands the rest to the scalar kernel.
+
+__attribute__(( target( "sse2" ) ))
+static void xorMultiSse2( unsigned char* dst, const unsigned char* base, const unsigned char* const* srcs, unsigned int numSrc, unsigned long long size )
+{
+  const unsigned long long w = sizeof( __m128i );
+  unsigned long long i = 0;
+  for( ; i + 4 * w <= size; i += 4 * w ) {
+    __m128i d0 = _mm_loadu_si128( ( const __m128i* )( base + i ) );
+    __m128i d1 = _mm_loadu_si128( ( const __m128i* )( base + i + w ) );
+    __m128i d2 = _mm_loadu_si128( ( const __m128i* )( base + i + 2 * w ) );
+    __m128i d3 = _mm_loadu_si128( ( const __m128i* )( base + i + 3 * w ) );
+    for( unsigned int s = 0; s < numSrc; s++ ) {
+      const unsigned char* p = srcs[ s ] + i;
+      d0 = _mm_xor_si128( d0, _mm_loadu_si128( ( const __m128i* ) p ) );
+      d1 = _mm_xor_si128( d1, _mm_loadu_si128( ( const __m128i* )( p + w ) ) );
+      d2 = _mm_xor_si128( d2, _mm_loadu_si128( ( const __m128i* )( p + 2 * w ) ) );
+      d3 = _mm_xor_si128( d3, _mm_loadu_si128( ( const __m128i* )( p + 3 * w ) ) );
+    }
+    _mm_storeu_si128( ( __m128i* )( dst + i ), d0 );
+    _mm_storeu_si128( ( __m128i* )( dst + i + w ), d1 );
+    _mm_storeu_si128( ( __m128i* )( dst + i + 2 * w ), d2 );
+    _mm_storeu_si128( ( __m128i* )( dst + i + 3 * w ), d3 );
+  }
+  for( ; i + w <= size; i += w ) {
+    __m128i d = _mm_loadu_si128( ( const __m128i* )( base + i ) );
+    for( unsigned int s = 0; s < numSrc; s++ ) {
+      d = _mm_xor_si128( d, _mm_loadu_si128( ( const __m128i* )( srcs[ s ] + i ) ) );
+    }
+    _mm_storeu_si128( ( __m128i* )( dst + i ), d );
+  }
+  if( i < size ) {
+    const unsigned char* tail[ numSrc ];
+    for( unsigned int s = 0; s < numSrc; s++ ) {
+      tail[ s ] = srcs[ s ] + i;
+    }
+    xorMultiScalar( dst + i, base + i, tail, numSrc, size - i );
+  }
+}
+
+
+__attribute__(( target( "avx2" ) ))
+static void xorMultiAvx2( unsigned char* dst, const unsigned char* base, const unsigned char* const* srcs, unsigned int numSrc, unsigned long long size )
+{
+  const unsigned long long w = sizeof( __m256i );
+  unsigned long long i = 0;
+  for( ; i + 4 * w <= size; i += 4 * w ) {
+    __m256i d0 = _mm256_loadu_si256( ( const __m256i* )( base + i ) );
+    __m256i d1 = _mm256_loadu_si256( ( const __m256i* )( base + i + w ) );
+    __m256i d2 = _mm256_loadu_si256( ( const __m256i* )( base + i + 2 * w ) );
+    __m256i d3 = _mm256_loadu_si256( ( const __m256i* )( base + i + 3 * w ) );
+    for( unsigned int s = 0; s < numSrc; s++ ) {
+      const unsigned char* p = srcs[ s ] + i;
+      d0 = _mm256_xor_si256( d0, _mm256_loadu_si256( ( const __m256i* ) p ) );
+      d1 = _mm256_xor_si256( d1, _mm256_loadu_si256( ( const __m256i* )( p + w ) ) );
+      d2 = _mm256_xor_si256( d2, _mm256_loadu_si256( ( const __m256i* )( p + 2 * w ) ) );
+      d3 = _mm256_xor_si256( d3, _mm256_loadu_si256( ( const __m256i* )( p + 3 * w ) ) );
+    }
+    _mm256_storeu_si256( ( __m256i* )( dst + i ), d0 );
+    _mm256_storeu_si256( ( __m256i* )( dst + i + w ), d1 );
+    _mm256_storeu_si256( ( __m256i* )( dst + i + 2 * w ), d2 );
+    _mm256_storeu_si256( ( __m256i* )( dst + i + 3 * w ), d3 );
+  }
+  for( ; i + w <= size; i += w ) {
+    __m256i d = _mm256_loadu_si256( ( const __m256i* )( base + i ) );
+    for( unsigned int s = 0; s < numSrc; s++ ) {
+      d = _mm256_xor_si256( d, _mm256_loadu_si256( ( const __m256i* )( srcs[ s ] + i ) ) );
+    }
+    _mm256_storeu_si256( ( __m256i* )( dst + i ), d );
+  }
+  _mm256_zeroupper();
+  if( i < size ) {
+    const unsigned char* tail[ numSrc ];
+    for( unsigned int s = 0; s < numSrc; s++ ) {
+      tail[ s ] = srcs[ s ] + i;
+    }
+    xorMultiScalar( dst + i, base + i, tail, numSrc, size - i );
+  }
+}
+
+
+__attribute__(( target( "avx512f" ) ))
+static void xorMultiAvx512( unsigned char* dst, const unsigned char* base, const unsigned char* const* srcs, unsigned int numSrc, unsigned long long size )
+{
+  const unsigned long long w = sizeof( __m512i );
+  unsigned long long i = 0;
+  for( ; i + 4 * w <= size; i += 4 * w ) {
+    __m512i d0 = _mm512_loadu_si512( ( const void* )( base + i ) );
+    __m512i d1 = _mm512_loadu_si512( ( const void* )( base + i + w ) );
+    __m512i d2 = _mm512_loadu_si512( ( const void* )( base + i + 2 * w ) );
+    __m512i d3 = _mm512_loadu_si512( ( const void* )( base + i + 3 * w ) );
+    for( unsigned int s = 0; s < numSrc; s++ ) {
+      const unsigned char* p = srcs[ s ] + i;
+      d0 = _mm512_xor_si512( d0, _mm512_loadu_si512( ( const void* ) p ) );
+      d1 = _mm512_xor_si512( d1, _mm512_loadu_si512( ( const void* )( p + w ) ) );
+      d2 = _mm512_xor_si512( d2, _mm512_loadu_si512( ( const void* )( p + 2 * w ) ) );
+      d3 = _mm512_xor_si512( d3, _mm512_loadu_si512( ( const void* )( p + 3 * w ) ) );
+    }
+    _mm512_storeu_si512( ( void* )( dst + i ), d0 );
+    _mm512_storeu_si512( ( void* )( dst + i + w ), d1 );
+    _mm512_storeu_si512( ( void* )( dst + i + 2 * w ), d2 );
+    _mm512_storeu_si512( ( void* )( dst + i + 3 * w ), d3 );
+  }
+  for( ; i + w <= size; i += w ) {
+    __m512i d = _mm512_loadu_si512( ( const void* )( base + i ) );
+    for( unsigned int s = 0; s < numSrc; s++ ) {
+      d = _mm512_xor_si512( d, _mm512_loadu_si512( ( const void* )( srcs[ s ] + i ) ) );
+    }
+    _mm512_storeu_si512( ( void* )( dst + i ), d );
+  }
+  _mm256_zeroupper();
+  if( i < size ) {
+    const unsigned char* tail[ numSrc ];
+    for( unsigned int s = 0; s < numSrc; s++ ) {
+      tail[ s ] = srcs[ s ] + i;
+    }
+    xorMultiScalar( dst + i, base + i, tail, numSrc, size - i );
+  }
+}
+
+#endif
+
+
+static bool xorIsaSupported( XorIsa isa )
+{
+  switch( isa ) {
+  case XOR_ISA_SCALAR:
+    return true;
+#ifdef XOR_X86
+  case XOR_ISA_SSE2:
+    return __builtin_cpu_supports( "sse2" );
+  case XOR_ISA_AVX2:
+    return __builtin_cpu_supports( "avx2" );
+  case XOR_ISA_AVX512:
+    return __builtin_cpu_supports( "avx512f" );
+#endif
+  default:
+    return false;
+  }
+}
+
+
+static XorMultiFunc xorFunc( XorIsa isa )
+{
+  switch( isa ) {
+#ifdef XOR_X86
+  case XOR_ISA_SSE2:
+    return xorMultiSse2;
+  case XOR_ISA_AVX2:
+    return xorMultiAvx2;
+  case XOR_ISA_AVX512:
+    return xorMultiAvx512;
+#endif
+  default:
+    return xorMultiScalar;
+  }
+}
+
+
+XorIsa xorDetectIsa()
+{
+#ifdef XOR_X86
+  __builtin_cpu_init(); // may run before constructors
+#endif
+  for( int isa = XOR_ISA_NUM - 1; isa > XOR_ISA_SCALAR; isa-- ) {
+    if( xorIsaSupported( ( XorIsa ) isa ) ) {
+      return ( XorIsa ) isa;
+    }
+  }
+  return XOR_ISA_SCALAR;
+}
+
+
+static XorIsa currIsa = xorDetectIsa();
+static XorMultiFunc currFunc = xorFunc( currIsa );
+
+
+XorIsa xorGetIsa()
+{
+  return currIsa;
+}
+
+
+bool xorSetIsa( XorIsa isa )
+{
+  if( isa < XOR_ISA_SCALAR || isa >= XOR_ISA_NUM || !xorIsaSupported( isa ) ) {
+    return false;
+  }
+  currIsa = isa;
+  currFunc = xorFunc( isa );
+  return true;
+}
+
+
+const char* xorIsaName( XorIsa isa )
+{
+  switch( isa ) {
+  case XOR_ISA_SCALAR:
+    return "scalar";
+  case XOR_ISA_SSE2:
+    return "sse2";
+  case XOR_ISA_AVX2:
+    return "avx2";
+  case XOR_ISA_AVX512:
+    return "avx512";
+  default:
+    return "unknown";
+  }
+}
+
+
+void xorBlock( unsigned char* dst, const unsigned char* src, unsigned long long size )
+{
+  currFunc( dst, dst, &src, 1, size );
+}
+
+
+void xorMulti( unsigned char* dst, const unsigned char* const* srcs, unsigned int numSrc, unsigned long long size )
+{
+  if( numSrc == 0 || size == 0 ) {
+    return;
+  }
+  currFunc( dst, dst, srcs, numSrc, size );
+}
+
+
+void xorMultiVar( unsigned char* dst, const unsigned char* const* srcs, const unsigned long long* sizes, unsigned int numSrc )
+{
+  unsigned long long size = 0;
+  for( unsigned int s = 0; s < numSrc; s++ ) {
+    size = sizes[ s ] > size ? sizes[ s ] : size;
+  }
+  xorMultiVarTo( dst, dst, size, srcs, sizes, numSrc );
+}
+
+
+void xorMultiVarTo( unsigned char* dst, const unsigned char* base, unsigned long long size, const unsigned char* const* srcs, const unsigned long long* sizes, unsigned int numSrc )
+{
+  // Order sources by length, then XOR band by band where the set of covering sources is fixed.
+  // The last band has no source left and only copies base when dst is another buffer.
+  unsigned int order[ numSrc ];
+  for( unsigned int s = 0; s < numSrc; s++ ) {
+    unsigned int j = s;
+    while( j > 0 && sizes[ order[ j - 1 ] ] > sizes[ s ] ) {
+      order[ j ] = order[ j - 1 ];
+      j--;
+    }
+    order[ j ] = s;
+  }
+
+  const unsigned char* band[ numSrc + 1 ];
+  unsigned long long start = 0;
+  for( unsigned int k = 0; k <= numSrc && start < size; k++ ) {
+    unsigned long long end = k < numSrc && sizes[ order[ k ] ] < size ? sizes[ order[ k ] ] : size;
+    if( end <= start || ( k == numSrc && dst == base ) ) {
+      continue;
+    }
+    for( unsigned int s = k; s < numSrc; s++ ) {
+      band[ s - k ] = srcs[ order[ s ] ] + start;
+    }
+    currFunc( dst + start, base + start, band, numSrc - k, end - start );
+    start = end;
+  }
+}
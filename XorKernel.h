@@ -0,0 +1,33 @@
+#ifndef _CMR_XORKERNEL
+#define _CMR_XORKERNEL
+
+// XOR kernels used by coded shuffling (encode and decode).
+// The widest instruction set supported by the CPU is selected at the first call.
+
+enum XorIsa {
+  XOR_ISA_SCALAR = 0,
+  XOR_ISA_SSE2,
+  XOR_ISA_AVX2,
+  XOR_ISA_AVX512,
+  XOR_ISA_NUM
+};
+
+XorIsa xorDetectIsa(); // widest instruction set available on this CPU
+XorIsa xorGetIsa(); // instruction set currently in use
+bool xorSetIsa( XorIsa isa ); // force an instruction set, false if the CPU does not support it
+const char* xorIsaName( XorIsa isa );
+
+// dst[ i ] ^= src[ i ] for i in [ 0, size )
+void xorBlock( unsigned char* dst, const unsigned char* src, unsigned long long size );
+
+// dst[ i ] ^= srcs[ 0 ][ i ] ^ ... ^ srcs[ numSrc - 1 ][ i ] for i in [ 0, size ), in one pass over dst
+void xorMulti( unsigned char* dst, const unsigned char* const* srcs, unsigned int numSrc, unsigned long long size );
+
+// Same as xorMulti for sources of different lengths: srcs[ s ] only covers [ 0, sizes[ s ] ) of dst
+void xorMultiVar( unsigned char* dst, const unsigned char* const* srcs, const unsigned long long* sizes, unsigned int numSrc );
+
+// dst[ i ] = base[ i ] ^ srcs[ 0 ][ i ] ^ ... for i in [ 0, size ), srcs[ s ] only covers [ 0, sizes[ s ] ).
+// Decodes a segment straight into its destination, dst may be base.
+void xorMultiVarTo( unsigned char* dst, const unsigned char* base, unsigned long long size, const unsigned char* const* srcs, const unsigned long long* sizes, unsigned int numSrc );
+
+#endif
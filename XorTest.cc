@@ -0,0 +1,132 @@
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <assert.h>
+
+#include "XorKernel.h"
+
+using namespace std;
+
+// Microbenchmark of the coding XOR kernels.
+// Usage: ./XorTest [ size in MB ] [ number of sources ] [ iterations ], exits with 1 on a mismatch
+
+int main( int argc, char* argv[] )
+{
+  unsigned long long size = ( argc > 1 ? atoll( argv[ 1 ] ) : 64 ) * 1000000ULL;
+  unsigned int numSrc = argc > 2 ? atoi( argv[ 2 ] ) : 2;
+  unsigned int numIter = argc > 3 ? atoi( argv[ 3 ] ) : 10;
+  assert( numSrc > 0 && numIter > 0 );
+
+  // Odd size so that every kernel also goes through its tail
+  size += 37;
+
+  srand( 0 );
+  unsigned char* src[ numSrc ];
+  for( unsigned int s = 0; s < numSrc; s++ ) {
+    src[ s ] = new unsigned char[ size ];
+    for( unsigned long long i = 0; i < size; i++ ) {
+      src[ s ][ i ] = rand() & 0xFF;
+    }
+  }
+  unsigned char* ref = new unsigned char[ size ]();
+  unsigned char* dst = new unsigned char[ size ];
+  unsigned char* base = new unsigned char[ size ];
+  for( unsigned long long i = 0; i < size; i++ ) {
+    base[ i ] = rand() & 0xFF;
+  }
+
+  // Reference result
+  for( unsigned int s = 0; s < numSrc; s++ ) {
+    for( unsigned long long i = 0; i < size; i++ ) {
+      ref[ i ] ^= src[ s ][ i ];
+    }
+  }
+
+  // Sources of different lengths, the first one covers the whole buffer
+  unsigned long long varSize[ numSrc ];
+  unsigned char* refVar = new unsigned char[ size ];
+  memcpy( refVar, base, size );
+  for( unsigned int s = 0; s < numSrc; s++ ) {
+    varSize[ s ] = size - ( s * 7919ULL ) % ( size / 2 );
+    for( unsigned long long i = 0; i < varSize[ s ]; i++ ) {
+      refVar[ i ] ^= src[ s ][ i ];
+    }
+  }
+
+  // Sources of different lengths, all shorter than the buffer
+  unsigned long long shortSize[ numSrc ];
+  unsigned char* refShort = new unsigned char[ size ];
+  memcpy( refShort, base, size );
+  for( unsigned int s = 0; s < numSrc; s++ ) {
+    shortSize[ s ] = size - 1 - ( ( s + 1 ) * 7919ULL ) % ( size / 2 );
+    for( unsigned long long i = 0; i < shortSize[ s ]; i++ ) {
+      refShort[ i ] ^= src[ s ][ i ];
+    }
+  }
+
+  cout << "Detected ISA: " << xorIsaName( xorDetectIsa() ) << endl;
+  cout << "Size = " << size << " bytes, sources = " << numSrc << ", iterations = " << numIter << endl;
+  unsigned int numFailed = 0;
+  for( int isa = XOR_ISA_SCALAR; isa < XOR_ISA_NUM; isa++ ) {
+    if( !xorSetIsa( ( XorIsa ) isa ) ) {
+      cout << setw( 8 ) << xorIsaName( ( XorIsa ) isa ) << ": not supported\n";
+      continue;
+    }
+
+    // Correctness: multi-source XOR and the same sources folded one by one
+    memset( dst, 0, size );
+    xorMulti( dst, src, numSrc, size );
+    bool correct = memcmp( dst, ref, size ) == 0;
+    memset( dst, 0, size );
+    for( unsigned int s = 0; s < numSrc; s++ ) {
+      xorBlock( dst, src[ s ], size );
+    }
+    correct = correct && memcmp( dst, ref, size ) == 0;
+    memcpy( dst, base, size );
+    xorMultiVar( dst, src, varSize, numSrc );
+    correct = correct && memcmp( dst, refVar, size ) == 0;
+    // Out of place, as when decoding into the partition buffer. dst starts with garbage.
+    unsigned long long sizes[ numSrc ];
+    for( unsigned int s = 0; s < numSrc; s++ ) {
+      sizes[ s ] = size;
+    }
+    memset( dst, 0xA5, size );
+    xorMultiVarTo( dst, src[ 0 ], size, ( const unsigned char* const* ) src + 1, sizes + 1, numSrc - 1 );
+    correct = correct && memcmp( dst, ref, size ) == 0;
+    // Sources shorter than the segment, out of place and in place
+    memset( dst, 0xA5, size );
+    xorMultiVarTo( dst, base, size, src, shortSize, numSrc );
+    correct = correct && memcmp( dst, refShort, size ) == 0;
+    memcpy( dst, base, size );
+    xorMultiVarTo( dst, dst, size, src, shortSize, numSrc );
+    correct = correct && memcmp( dst, refShort, size ) == 0;
+
+    clock_t time = clock();
+    for( unsigned int it = 0; it < numIter; it++ ) {
+      xorMulti( dst, src, numSrc, size );
+    }
+    time = clock() - time;
+    double sec = double( time ) / CLOCKS_PER_SEC;
+
+    // Throughput counts every byte read and written
+    double bytes = double( size ) * ( numSrc + 2 ) * numIter;
+    cout << setw( 8 ) << xorIsaName( ( XorIsa ) isa )
+	 << ": " << setw( 10 ) << bytes / sec * 1e-9 << " GB/s"
+	 << "   Output = " << setw( 10 ) << double( size ) * numIter / sec * 1e-9 << " GB/s"
+	 << ( correct ? "" : "   MISMATCH" ) << endl;
+    numFailed += correct ? 0 : 1;
+  }
+
+  for( unsigned int s = 0; s < numSrc; s++ ) {
+    delete [] src[ s ];
+  }
+  delete [] ref;
+  delete [] refVar;
+  delete [] refShort;
+  delete [] base;
+  delete [] dst;
+
+  return numFailed > 0 ? 1 : 0;
+}
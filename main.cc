@@ -1,27 +1,113 @@
 #include <iostream>
+#include <fstream>
+#include <cassert>
 #include <mpi.h>
 
+#include "CodedConfiguration.h"
 #include "Master.h"
 #include "Worker.h"
+#include "CodedMaster.h"
+#include "CodedWorker.h"
+#include "BufferAllocator.h"
+#include "Planner.h"
 
 using namespace std;
 
-int main()
+// Uncoded and coded TeraSort in one program, see CodedConfiguration::printUsage for the options.
+// Every process parses the same command line, the master then broadcasts its configuration.
+int main( int argc, char* argv[] )
 {
-  MPI_Init(NULL, NULL); // 初始化MPI环境
+  // 解码线程和线程池与主线程的 MPI 调用同时运行，但只有主线程调用 MPI
+  int provided;
+  MPI_Init_thread( &argc, &argv, MPI_THREAD_FUNNELED, &provided ); // 初始化MPI环境
   int nodeRank, nodeTotal; // 节点编号，节点总数
-  MPI_Comm_rank(MPI_COMM_WORLD, &nodeRank); // 获取节点编号
-  MPI_Comm_size(MPI_COMM_WORLD, &nodeTotal); // 获取节点总数
+  MPI_Comm_rank( MPI_COMM_WORLD, &nodeRank ); // 获取节点编号
+  MPI_Comm_size( MPI_COMM_WORLD, &nodeTotal ); // 获取节点总数
 
-  if (nodeRank == 0) { // 如果是主节点
-    Master masterNode(nodeRank, nodeTotal); // 创建主节点
-    masterNode.run();
+  CodedConfiguration conf;
+  if ( !conf.parseArgs( argc, argv ) ) {
+    if ( nodeRank == 0 ) {
+      CodedConfiguration::printUsage( argv[ 0 ] );
+    }
+    MPI_Finalize();
+    return 1;
+  }
+
+  // Without thread support everything runs on the main thread
+  if ( provided < MPI_THREAD_FUNNELED ) {
+    if ( nodeRank == 0 ) {
+      cout << "MPI does not support threads, decoding, encoding and sorting run serially.\n";
+    }
+    conf.setNumDecodeThread( 0 );
+    conf.setNumEncodeThread( 1 );
+    conf.setNumSortThread( 1 );
+    conf.setNumTouchThread( 1 );
+  }
+
+  setBufferPolicy( ( HugePageMode ) conf.getHugePage(), conf.getNumaNode(), conf.getNumTouchThread() );
+
+  // Workers get a communicator of their own, the master one with only itself
+  MPI_Comm nodeComm;
+  MPI_Comm_split( MPI_COMM_WORLD, nodeRank == 0 ? 0 : 1, nodeRank, &nodeComm );
+
+  // CHOOSE UNCODED TERASORT OR THE LOAD OF CODED TERASORT FROM A CALIBRATION OF THE WORKERS
+  // 在创建主节点和工作节点之前决定算法，所有进程都收到主节点的选择
+  bool predicted = false;
+  Planner::PhaseTime pred;
+  if ( conf.getAutoLoad() ) {
+    Planner::Calibration cal = Planner::calibrate( conf, nodeRank, nodeComm );
+    unsigned int load = 0; // 0 = uncoded TeraSort
+    if ( nodeRank == 0 ) {
+      ifstream inputFile( conf.getInputPath(), ios::in | ios::binary | ios::ate );
+      if ( !inputFile.is_open() ) {
+	cout << nodeRank << ": Cannot open input file " << conf.getInputPath() << endl;
+	assert( false );
+      }
+      unsigned long long inputSize = inputFile.tellg();
+      inputFile.close();
+      // Partitions are received into one buffer unless REDUCE has a memory budget, UNPACK copies nothing then
+      Planner planner( conf.getNumReducer(), inputSize, inputSize / conf.getLineSize(), cal, conf.getMemoryBudget() > 0 );
+      planner.printPlan( nodeRank );
+      load = planner.chooseCoded() ? planner.chooseLoad() : 0;
+      pred = load > 0 ? planner.predict( load ) : planner.predictUncoded();
+      predicted = true;
+    }
+    MPI_Bcast( &load, 1, MPI_UNSIGNED, 0, MPI_COMM_WORLD );
+    conf.setCoded( load > 0 );
+    conf.setLoad( load > 0 ? load : 1 );
+    conf.setNumInput( load > 0 ? ( unsigned int ) ( Planner::getBinom( conf.getNumReducer(), load ) + 0.5 ) : conf.getNumReducer() );
+  }
+
+  if ( !conf.isCoded() ) {
+    if ( nodeRank == 0 ) { // 如果是主节点
+      Master masterNode( nodeRank, nodeTotal, conf ); // 创建主节点
+      if ( predicted ) {
+	masterNode.setPrediction( pred );
+      }
+      masterNode.run();
+    }
+    else {
+      Worker workerNode( nodeRank, conf );
+      workerNode.setWorkerComm( nodeComm );
+      workerNode.run();
+    }
   }
   else {
-    Worker workerNode(nodeRank);
-    workerNode.run();
+    if ( nodeRank == 0 ) {
+      CodedMaster masterNode( nodeRank, nodeTotal, conf );
+      if ( predicted ) {
+	masterNode.setPrediction( pred );
+      }
+      masterNode.run();
+    }
+    else {
+      CodedWorker workerNode( nodeRank, conf );
+      workerNode.setWorkerComm( nodeComm );
+      workerNode.run();
+    }
   }
 
+  releaseBufferPolicy();
   MPI_Finalize();
 
   return 0;